@@ -0,0 +1,121 @@
+import Sys.println in log;
+import steam.Networking;
+
+/**
+	Measures the P2P path over the loopback backend, no Steam client needed.
+	Usage : hl netbench.hl [packetCount] [packetSize] [batchSize]
+	or hl netbench.hl -replay <capture> to read the channel 0 packets of a capture as fast as possible.
+**/
+class NetBench {
+
+	static var latencies : Array<Float>;
+	static var received : Int;
+	static var bytes : Float;
+
+	public static function main() {
+		var args = Sys.args();
+		if( args[0] == "-replay" ) {
+			replay(args[1]);
+			Sys.exit(0);
+		}
+		var count = args.length > 0 ? Std.parseInt(args[0]) : 1000000;
+		var size = args.length > 1 ? Std.parseInt(args[1]) : 64;
+		var batch = args.length > 2 ? Std.parseInt(args[2]) : 100;
+		if( size < 8 ) size = 8;
+
+		if( !Networking.setBackend(Loopback) )
+			throw "Loopback backend not available";
+
+		log("Sending " + count + " packets of " + size + " bytes, " + batch + " per frame");
+		run("send_p2p_packet / read_p2p_packet_id", count, size, batch, readRaw);
+		run("Networking dispatch", count, size, batch, readDispatch);
+		Networking.setCoalesce(0, true);
+		run("Networking dispatch, coalesced", count, size, batch, readDispatch);
+		Networking.setCoalesce(0, false);
+		Networking.closeP2P();
+		// startP2P registered a main loop event
+		Sys.exit(0);
+	}
+
+	static function run( name : String, count : Int, size : Int, batch : Int, read : Void -> Void ) {
+		var peer = steam.User.fromUID32(1);
+		var data = haxe.io.Bytes.alloc(size);
+		latencies = [];
+		received = 0;
+		var start = Networking.getTime();
+		var sent = 0;
+		while( sent < count ) {
+			for( i in 0...batch ) {
+				// each packet carries its send time
+				data.setDouble(0, Networking.getTime());
+				if( !Networking.sendP2P(peer, data, Unreliable) )
+					throw "Send failed";
+			}
+			sent += batch;
+			read();
+		}
+		var time = Networking.getTime() - start;
+		latencies.sort(Reflect.compare);
+		var total = 0.;
+		for( l in latencies ) total += l;
+		log(name);
+		log("  " + Std.int(received / time) + " packets/s, " + Std.int(received * size / time / 1024) + " KB/s");
+		log("  latency avg " + us(total / latencies.length) + " p50 " + us(latencies[latencies.length >> 1]) + " p99 " + us(latencies[Std.int(latencies.length * 0.99)]) + " max " + us(latencies[latencies.length - 1]));
+		if( received != sent )
+			log("  " + (sent - received) + " packets lost");
+	}
+
+	static function replay( path : String ) {
+		if( !Networking.startReplay(path, 0) )
+			throw "Can't open capture " + path;
+		var total = Networking.getReplayRemaining();
+		log("Replaying " + total + " received packets");
+		latencies = [];
+		received = 0;
+		bytes = 0;
+		var start = Networking.getTime();
+		while( true ) {
+			var before = received;
+			readDispatch();
+			if( received == before ) break;
+		}
+		var time = Networking.getTime() - start;
+		log("  " + received + " packets in " + us(time) + ", " + Std.int(received / time) + " packets/s, " + Std.int(bytes / time / 1024) + " KB/s");
+		Networking.stopReplay();
+		Networking.closeP2P();
+	}
+
+	static function us( t : Float ) {
+		return Std.int(t * 1e6) + "us";
+	}
+
+	static var buffer = new hl.Bytes(1 << 16);
+
+	static function readRaw() {
+		var len = 0;
+		while( @:privateAccess Networking.read_p2p_packet_id(buffer, 1 << 16, len, 0) != 0 ) {
+			latencies.push(Networking.getTime() - buffer.getF64(0));
+			received++;
+		}
+	}
+
+	static var started = false;
+
+	static function readDispatch() {
+		if( !started ) {
+			started = true;
+			Networking.startP2P({
+				onConnectionRequest : function(_) return true,
+				onConnectionError : function(_, _) {},
+				onData : function(_, _) {},
+				onRawData : function(_, data, len) {
+					latencies.push(Networking.getTime() - data.getF64(0));
+					received++;
+					bytes += len;
+				},
+			});
+		}
+		@:privateAccess Networking.checkP2PMessage();
+	}
+
+}
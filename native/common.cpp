@@ -1,4 +1,9 @@
 #include "steamwrap.h"
+#include <set>
+#include <unordered_map>
+
+#define FIELD_DECL(name) HLField field_##name(#name);
+#include "fields.h"
 
 void hl_set_uid( vdynamic *out, int64 uid ) {
 	out->t = &hlt_uid;
@@ -32,6 +37,11 @@ vuid hl_of_uid( CSteamID uid ) {
 	return (vuid)hl_copy_bytes(data.b, 8);
 }
 
+// writes into a preallocated UID, as found in typed events
+void hl_write_uid( vuid out, uint64 uid ) {
+	memcpy(out, &uid, 8);
+}
+
 vuid hl_of_uint64(uint64 uid) {
 	union {
 		vbyte b[8];
@@ -41,6 +51,38 @@ vuid hl_of_uint64(uint64 uid) {
 	return (vuid)hl_copy_bytes(data.b, 8);
 }
 
+// Interned ids : each 64 bits id (user, lobby, item...) gets an index that is stable for the whole session,
+// so that the primitives called in loops can return ids without allocating. 0 is the nil id. Main thread only.
+static std::vector<uint64> s_idValues(1, 0);
+static std::unordered_map<uint64, int> s_idIndexes;
+
+int hl_intern_id( uint64 id ) {
+	if( id == 0 ) return 0;
+	std::unordered_map<uint64, int>::iterator it = s_idIndexes.find(id);
+	if( it != s_idIndexes.end() )
+		return it->second;
+	int index = (int)s_idValues.size();
+	s_idValues.push_back(id);
+	s_idIndexes[id] = index;
+	return index;
+}
+
+uint64 hl_id_value( int id ) {
+	return id > 0 && id < (int)s_idValues.size() ? s_idValues[id] : 0;
+}
+
+HL_PRIM int HL_NAME(intern_uid)( vuid uid ) {
+	return uid ? hl_intern_id(hl_to_uint64(uid)) : 0;
+}
+
+HL_PRIM vuid HL_NAME(get_interned_uid)( int id ) {
+	uint64 v = hl_id_value(id);
+	return v ? hl_of_uint64(v) : NULL;
+}
+
+DEFINE_PRIM(_ID, intern_uid, _UID);
+DEFINE_PRIM(_UID, get_interned_uid, _ID);
+
 void dyn_call_result( vclosure *c, vdynamic *p, bool error ) {
 	vdynamic b;
 	vdynamic *args[2];
@@ -94,17 +136,124 @@ static void GlobalEvent( int id, vdynamic *v ) {
 	hl_dyn_call(s_globalEvent, args, 2);
 }
 
-#define EVENT_DECL(name,type) void CallbackHandler::On##name( type *t ) { GlobalEvent(type::k_iCallback, Encode##name(t)); }
+TypedEvents s_typedEvents;
+EventMask s_eventMask;
+
+// Event queue : when enabled, the global events are copied as (id, size, callback struct) records
+// into a ring during SteamAPI_RunCallbacks, then all dispatched at once by dispatch_events.
+// Low priority events have their own ring : they can be deferred, and are dropped when it is full.
+static bool s_queueEvents = false;
+static EventRing s_events(EVENT_RING_SIZE, true);
+static EventRing s_lowEvents(EVENT_RING_SIZE, false);
+static std::set<int> s_lowPriority;
+
+static void QueueEvent( int id, const void *data, int size ) {
+	if( s_lowPriority.count(id) )
+		s_lowEvents.Push(id, data, size);
+	else
+		s_events.Push(id, data, size);
+}
+
+#define EVENT_DECL(name,type) \
+	void CallbackHandler::On##name( type *t ) { \
+		if( !s_eventMask.Has(type::k_iCallback) && !s_typedEvents.Get(type::k_iCallback) ) \
+			return; \
+		if( s_queueEvents ) \
+			QueueEvent(type::k_iCallback, t, sizeof(type)); \
+		else \
+			Deliver##name(t); \
+	} \
+	void CallbackHandler::Deliver##name( type *t ) { \
+		typed_event *e = s_typedEvents.Get(type::k_iCallback); \
+		int64 start = profile_start(), encoded; \
+		if( e ) { \
+			Fill##name(e->obj, t); \
+			encoded = profile_start(); \
+			TypedEvents::Call(e); \
+		} else { \
+			vdynamic *v = Encode##name(t); \
+			encoded = profile_start(); \
+			GlobalEvent(type::k_iCallback, v); \
+		} \
+		profile_callback(type::k_iCallback, false, start, encoded); \
+	}
 #define GLOBAL_EVENTS
 #include "events.h"
+
+void CallbackHandler::Dispatch( int id, void *data ) {
+	switch( id ) {
+#	define EVENT_DECL(name,type) case type::k_iCallback: Deliver##name((type*)data); break;
+#	include "events.h"
+	}
+}
 #undef GLOBAL_EVENTS
 
+// manual dispatch : all the callbacks, including the ones that are not global events
+void CallbackHandler::RouteCallbacks() {
+#	define EVENT_DECL(name,type) route_callback(type::k_iCallback, CALLBACK_BASE(&m_##name), false);
+#	include "events.h"
+}
+
+static int dispatch_ring( EventRing *r, int max ) {
+	int n = 0, id, size;
+	vbyte *data;
+	while( n != max && (data = r->Peek(&id, &size)) != NULL ) {
+		r->Pop(size);
+		n++;
+		if( s_callbackHandler ) s_callbackHandler->Dispatch(id, data);
+	}
+	return n;
+}
+
 vdynamic *CallbackHandler::EncodeOverlayActivated(GameOverlayActivated_t *d) {
 	HLValue ret;
-	ret.Set("active", d->m_bActive != 0);
+	ret.Set(field_active, d->m_bActive != 0);
 	return ret.value;
 }
 
+typedef struct {
+	hl_type *t;
+	int id;
+	bool active;
+} overlay_activated_obj;
+
+void CallbackHandler::FillOverlayActivated( event_obj *o, GameOverlayActivated_t *d ) {
+	((overlay_activated_obj*)o)->active = d->m_bActive != 0;
+}
+
+HL_PRIM void HL_NAME(register_typed_event)( int id, event_obj *obj, vclosure *callb ) {
+	s_typedEvents.Register(id, obj, callb);
+}
+
+HL_PRIM void HL_NAME(subscribe_event)( int id, bool b ) {
+	s_eventMask.Set(id, b);
+}
+
+HL_PRIM void HL_NAME(set_event_queue)( bool b ) {
+	s_queueEvents = b;
+}
+
+HL_PRIM void HL_NAME(set_event_priority)( int id, bool low ) {
+	if( low )
+		s_lowPriority.insert(id);
+	else
+		s_lowPriority.erase(id);
+}
+
+// dispatches all the queued events, but at most maxLow low priority ones (all if < 0), returns the number dispatched
+HL_PRIM int HL_NAME(dispatch_events)( int maxLow ) {
+	int n = dispatch_ring(&s_events, -1);
+	return n + dispatch_ring(&s_lowEvents, maxLow);
+}
+
+HL_PRIM int HL_NAME(get_queued_events)() {
+	return s_events.count + s_lowEvents.count;
+}
+
+HL_PRIM int HL_NAME(get_dropped_events)() {
+	return s_lowEvents.dropped;
+}
+
 HL_PRIM bool HL_NAME(init)( vclosure *onEvent, vclosure *onGlobalEvent ){
 	bool result = SteamAPI_Init();
 	if (result)	{
@@ -122,15 +271,42 @@ HL_PRIM void HL_NAME(set_notification_position)( ENotificationPosition pos ) {
 }
 
 HL_PRIM void HL_NAME(shutdown)(){
+	if( s_callbackHandler ) stats_update(true);
 	SteamAPI_Shutdown();
 	// TODO gc_root
 	g_eventHandler = NULL;
+	manual_dispatch_reset(false);
 	delete s_callbackHandler;
 	s_callbackHandler = NULL;
 }
 
+HL_PRIM bool HL_NAME(init_manual_dispatch)();
+
 HL_PRIM void HL_NAME(run_callbacks)(){
-	SteamAPI_RunCallbacks();
+	// enabled by the game server, manual dispatch also applies to the client
+	if( manual_dispatch_global && !manual_dispatch_enabled(false) )
+		HL_NAME(init_manual_dispatch)();
+	if( manual_dispatch_enabled(false) )
+		manual_dispatch_run(false, 0);
+	else
+		SteamAPI_RunCallbacks();
+	if( s_callbackHandler ) stats_update(false);
+}
+
+// to call right after init : callbacks are then run by run_manual_callbacks, within a budget in microseconds
+HL_PRIM bool HL_NAME(init_manual_dispatch)(){
+	if( !s_callbackHandler ) return false;
+	if( manual_dispatch_enabled(false) ) return true;
+	if( !manual_dispatch_init(false) ) return false;
+	s_callbackHandler->RouteCallbacks();
+	return true;
+}
+
+// returns the number of callbacks left for the next frames
+HL_PRIM int HL_NAME(run_manual_callbacks)( int budget ){
+	int left = manual_dispatch_run(false, budget);
+	if( s_callbackHandler ) stats_update(false);
+	return left;
 }
 
 HL_PRIM bool HL_NAME(open_overlay)(vbyte *url){
@@ -141,9 +317,18 @@ HL_PRIM bool HL_NAME(open_overlay)(vbyte *url){
 }
 
 DEFINE_PRIM(_BOOL, init, _FUN(_VOID, _I32 _BOOL _BYTES) _FUN(_VOID, _I32 _DYN));
+DEFINE_PRIM(_VOID, register_typed_event, _I32 _EVENT _FUN(_VOID, _EVENT));
+DEFINE_PRIM(_VOID, subscribe_event, _I32 _BOOL);
+DEFINE_PRIM(_VOID, set_event_queue, _BOOL);
+DEFINE_PRIM(_VOID, set_event_priority, _I32 _BOOL);
+DEFINE_PRIM(_I32, dispatch_events, _I32);
+DEFINE_PRIM(_I32, get_queued_events, _NO_ARG);
+DEFINE_PRIM(_I32, get_dropped_events, _NO_ARG);
 DEFINE_PRIM(_VOID, set_notification_position, _I32);
 DEFINE_PRIM(_VOID, shutdown, _NO_ARG);
 DEFINE_PRIM(_VOID, run_callbacks, _NO_ARG);
+DEFINE_PRIM(_BOOL, init_manual_dispatch, _NO_ARG);
+DEFINE_PRIM(_I32, run_manual_callbacks, _I32);
 DEFINE_PRIM(_BOOL, open_overlay, _BYTES);
 
 //-----------------------------------------------------------------------------------------------------------
@@ -200,11 +385,24 @@ HL_PRIM vbyte *HL_NAME(get_current_beta_name)() {
 
 vdynamic *CallbackHandler::EncodeAuthSessionTicketResponse(GetAuthSessionTicketResponse_t *d) {
 	HLValue ret;
-	ret.Set("authTicket", d->m_hAuthTicket);
-	ret.Set("result", d->m_eResult);
+	ret.Set(field_authTicket, d->m_hAuthTicket);
+	ret.Set(field_result, d->m_eResult);
 	return ret.value;
 }
 
+typedef struct {
+	hl_type *t;
+	int id;
+	int authTicket;
+	int result;
+} auth_ticket_obj;
+
+void CallbackHandler::FillAuthSessionTicketResponse( event_obj *o, GetAuthSessionTicketResponse_t *d ) {
+	auth_ticket_obj *e = (auth_ticket_obj*)o;
+	e->authTicket = d->m_hAuthTicket;
+	e->result = d->m_eResult;
+}
+
 
 HL_PRIM vbyte *HL_NAME(get_auth_ticket)( int *size, int *authTicket ) {
 	vbyte *ticket = hl_alloc_bytes(1024);
@@ -269,6 +467,7 @@ public:
 		hl_add_root(&m_callback);
 		SteamAPICall_t steamCb = SteamUser()->RequestEncryptedAppTicket(data, data_size);
 		m_EncryptedAppTicketResponseCallResult.Set(steamCb, this, &EncryptedAppTicketRequest::OnResponse);
+		track_call_result(steamCb, CALLBACK_BASE(&m_EncryptedAppTicketResponseCallResult));
 	}
 
 	~EncryptedAppTicketRequest()
@@ -0,0 +1,262 @@
+#include "steamwrap.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define DELTA_SSE2
+#endif
+
+// Snapshot delta codec : a state is XORed against the last snapshot the peer acknowledged, and the
+// result is encoded as runs of (zero bytes count, literal count, literal bytes). Trailing zeros are implicit.
+// Encoded snapshots start with the 16 bits sequence, the distance to the baseline (0 for none) and the varint state size.
+#define DELTA_HEADER_MAX	8
+#define DELTA_MIN_ZEROS		4
+
+typedef struct {
+	int seq; // -1 when empty
+	int size;
+	bool acked;
+} delta_entry;
+
+typedef struct {
+	int nextSeq;
+	std::vector<delta_entry> entries;
+	std::vector<vbyte> data;
+} delta_peer;
+
+typedef struct {
+	int stateSize;
+	int history;
+	std::map<uint64, delta_peer> sent;
+	std::map<uint64, delta_peer> received;
+	std::vector<vbyte> scratch;
+} delta_codec;
+
+static void xor_bytes( vbyte *out, const vbyte *a, const vbyte *b, int size ) {
+	int i = 0;
+#ifdef DELTA_SSE2
+	for(;i+16<=size;i+=16)
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+#endif
+	for(;i<size;i++)
+		out[i] = a[i] ^ b[i];
+}
+
+static int skip_zeros( const vbyte *data, int pos, int size ) {
+#ifdef DELTA_SSE2
+	__m128i zero = _mm_setzero_si128();
+	while( pos + 16 <= size ) {
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + pos)), zero));
+		if( mask != 0xFFFF ) {
+			while( mask & 1 ) {
+				mask >>= 1;
+				pos++;
+			}
+			return pos;
+		}
+		pos += 16;
+	}
+#endif
+	while( pos < size && data[pos] == 0 )
+		pos++;
+	return pos;
+}
+
+// end of the literal run starting at pos : stops before DELTA_MIN_ZEROS consecutive zero bytes
+static int skip_literals( const vbyte *data, int pos, int size ) {
+	int zeros = 0;
+	while( pos < size ) {
+		if( data[pos++] ) {
+			zeros = 0;
+			continue;
+		}
+		if( ++zeros == DELTA_MIN_ZEROS )
+			return pos - zeros;
+	}
+	return pos - zeros;
+}
+
+static int write_delta_varint( vbyte *out, uint32 v ) {
+	int n = 0;
+	while( v >= 0x80 ) {
+		out[n++] = (vbyte)(v | 0x80);
+		v >>= 7;
+	}
+	out[n++] = (vbyte)v;
+	return n;
+}
+
+static int read_delta_varint( const vbyte *in, int size, uint32 *v ) {
+	uint32 r = 0;
+	for(int n=0;n<size && n<5;n++) {
+		r |= (uint32)(in[n] & 0x7F) << (7 * n);
+		if( !(in[n] & 0x80) ) {
+			*v = r;
+			return n + 1;
+		}
+	}
+	return -1;
+}
+
+static delta_peer *get_delta_peer( delta_codec *c, std::map<uint64, delta_peer> &peers, uint64 uid ) {
+	std::map<uint64, delta_peer>::iterator it = peers.find(uid);
+	if( it != peers.end() )
+		return &it->second;
+	delta_peer *p = &peers[uid];
+	p->nextSeq = 0;
+	delta_entry e = { -1, 0, false };
+	p->entries.assign(c->history, e);
+	p->data.resize((size_t)c->history * c->stateSize);
+	return p;
+}
+
+static vbyte *delta_entry_data( delta_codec *c, delta_peer *p, int seq ) {
+	return &p->data[(size_t)(seq & (c->history - 1)) * c->stateSize];
+}
+
+// history is rounded to a power of two (up to 128) so that the ring index survives the sequence wrap
+HL_PRIM delta_codec *HL_NAME(delta_codec_alloc)( int stateSize, int history ) {
+	if( stateSize <= 0 || history <= 0 || history > 128 )
+		return NULL;
+	delta_codec *c = new delta_codec();
+	c->stateSize = stateSize;
+	c->history = 1;
+	while( c->history < history )
+		c->history <<= 1;
+	c->scratch.resize(stateSize);
+	return c;
+}
+
+HL_PRIM void HL_NAME(delta_codec_free)( delta_codec *c ) {
+	delete c;
+}
+
+// forget the snapshots exchanged with a peer, the next state sent to it is encoded without baseline
+HL_PRIM void HL_NAME(delta_codec_reset)( delta_codec *c, vuid uid ) {
+	uint64 id = hl_to_uid(uid).ConvertToUint64();
+	c->sent.erase(id);
+	c->received.erase(id);
+}
+
+// encodes state against the newest baseline acknowledged by the peer, returns the encoded size or -1 if out is too small
+HL_PRIM int HL_NAME(delta_encode)( delta_codec *c, vuid uid, vbyte *state, int size, vbyte *out, int outSize ) {
+	if( size < 0 || size > c->stateSize )
+		return -1;
+	delta_peer *p = get_delta_peer(c, c->sent, hl_to_uid(uid).ConvertToUint64());
+	int seq = p->nextSeq;
+	int dist = 0;
+	for(int d=1;d<c->history;d++) {
+		delta_entry *e = &p->entries[(seq - d) & (c->history - 1)];
+		if( e->seq == ((seq - d) & 0xFFFF) && e->acked ) {
+			dist = d;
+			break;
+		}
+	}
+	vbyte *delta = size ? &c->scratch[0] : NULL;
+	if( dist ) {
+		delta_entry *base = &p->entries[(seq - dist) & (c->history - 1)];
+		vbyte *baseData = delta_entry_data(c, p, seq - dist);
+		int common = base->size < size ? base->size : size;
+		xor_bytes(delta, state, baseData, common);
+		memcpy(delta + common, state + common, size - common);
+	} else if( size )
+		memcpy(delta, state, size);
+	if( outSize < DELTA_HEADER_MAX )
+		return -1;
+	out[0] = (vbyte)seq;
+	out[1] = (vbyte)(seq >> 8);
+	out[2] = (vbyte)dist;
+	int len = 3 + write_delta_varint(out + 3, size);
+	int pos = 0;
+	while( true ) {
+		int start = skip_zeros(delta, pos, size);
+		if( start == size )
+			break;
+		int end = skip_literals(delta, start, size);
+		vbyte run[10];
+		int n = write_delta_varint(run, start - pos);
+		n += write_delta_varint(run + n, end - start);
+		if( len + n + end - start > outSize )
+			return -1;
+		memcpy(out + len, run, n);
+		len += n;
+		memcpy(out + len, delta + start, end - start);
+		len += end - start;
+		pos = end;
+	}
+	// keep the state as a future baseline, once the peer acknowledges it
+	delta_entry *e = &p->entries[seq & (c->history - 1)];
+	e->seq = seq;
+	e->size = size;
+	e->acked = false;
+	memcpy(delta_entry_data(c, p, seq), state, size);
+	p->nextSeq = (seq + 1) & 0xFFFF;
+	return len;
+}
+
+HL_PRIM bool HL_NAME(delta_ack)( delta_codec *c, vuid uid, int seq ) {
+	std::map<uint64, delta_peer>::iterator it = c->sent.find(hl_to_uid(uid).ConvertToUint64());
+	if( it == c->sent.end() )
+		return false;
+	delta_entry *e = &it->second.entries[seq & (c->history - 1)];
+	if( e->seq != (seq & 0xFFFF) )
+		return false;
+	e->acked = true;
+	return true;
+}
+
+// decodes a snapshot into out, returns its size, or -1 if the baseline is no longer known or the data is invalid
+HL_PRIM int HL_NAME(delta_decode)( delta_codec *c, vuid uid, vbyte *data, int length, vbyte *out, int outSize ) {
+	uint32 size;
+	int n;
+	if( length < 4 || (n = read_delta_varint(data + 3, length - 3, &size)) < 0 || size > (uint32)c->stateSize || size > (uint32)outSize )
+		return -1;
+	int seq = data[0] | (data[1] << 8);
+	int dist = data[2];
+	if( dist >= c->history )
+		return -1;
+	delta_peer *p = get_delta_peer(c, c->received, hl_to_uid(uid).ConvertToUint64());
+	// decoded aside : the ring entry is only replaced once the snapshot is known to be valid
+	vbyte *state = size ? &c->scratch[0] : NULL;
+	if( dist ) {
+		delta_entry *base = &p->entries[(seq - dist) & (c->history - 1)];
+		if( base->seq != ((seq - dist) & 0xFFFF) )
+			return -1;
+		int common = base->size < (int)size ? base->size : (int)size;
+		memcpy(state, delta_entry_data(c, p, seq - dist), common);
+		memset(state + common, 0, size - common);
+	} else
+		memset(state, 0, size);
+	int pos = 0;
+	int in = 3 + n;
+	while( in < length ) {
+		uint32 zeros, count;
+		if( (n = read_delta_varint(data + in, length - in, &zeros)) < 0 )
+			return -1;
+		in += n;
+		if( (n = read_delta_varint(data + in, length - in, &count)) < 0 )
+			return -1;
+		in += n;
+		if( zeros > size - pos || count > size - pos - zeros || count > (uint32)(length - in) )
+			return -1;
+		pos += zeros;
+		xor_bytes(state + pos, state + pos, data + in, count);
+		pos += count;
+		in += count;
+	}
+	delta_entry *e = &p->entries[seq & (c->history - 1)];
+	e->seq = seq;
+	e->size = size;
+	e->acked = true;
+	memcpy(delta_entry_data(c, p, seq), state, size);
+	memcpy(out, state, size);
+	return size;
+}
+
+#define _CODEC _ABSTRACT(steam_delta_codec)
+
+DEFINE_PRIM(_CODEC, delta_codec_alloc, _I32 _I32);
+DEFINE_PRIM(_VOID, delta_codec_free, _CODEC);
+DEFINE_PRIM(_VOID, delta_codec_reset, _CODEC _UID);
+DEFINE_PRIM(_I32, delta_encode, _CODEC _UID _BYTES _I32 _BYTES _I32);
+DEFINE_PRIM(_BOOL, delta_ack, _CODEC _UID _I32);
+DEFINE_PRIM(_I32, delta_decode, _CODEC _UID _BYTES _I32 _BYTES _I32);
@@ -0,0 +1,145 @@
+#include "steamwrap.h"
+#include <chrono>
+
+// Manual dispatch : each frame, the callbacks are moved from the Steam pipe into a queue, call results
+// being fetched at once, then run until the time budget is spent. The rest is kept for the next frames.
+#define CALL_RESULT_ID		SteamAPICallCompleted_t::k_iCallback
+
+typedef struct {
+	SteamAPICall_t call;
+	int failed;
+	int size;
+} call_result_header;
+
+class CallbackRouter {
+public:
+	bool enabled;
+	HSteamPipe pipe;
+	std::map<int, std::vector<CCallbackBase*> > callbacks;
+	std::map<SteamAPICall_t, CCallbackBase*> calls;
+	EventRing queue;
+	std::vector<vbyte> scratch;
+	CallbackRouter() : enabled(false), pipe(0), queue(EVENT_RING_SIZE, true) {}
+
+	void Reset( bool keepCalls = false ) {
+		int id, size;
+		while( queue.Peek(&id, &size) )
+			queue.Pop(size);
+		callbacks.clear();
+		if( !keepCalls ) calls.clear();
+		enabled = false;
+	}
+
+	void Poll() {
+#ifdef STEAM_MANUAL_DISPATCH
+		CallbackMsg_t msg;
+		SteamAPI_ManualDispatch_RunFrame(pipe);
+		while( SteamAPI_ManualDispatch_GetNextCallback(pipe, &msg) ) {
+			if( msg.m_iCallback == CALL_RESULT_ID ) {
+				SteamAPICallCompleted_t *c = (SteamAPICallCompleted_t*)msg.m_pubParam;
+				if( calls.count(c->m_hAsyncCall) ) {
+					scratch.resize(sizeof(call_result_header) + c->m_cubParam);
+					call_result_header *h = (call_result_header*)&scratch[0];
+					bool failed = false;
+					if( SteamAPI_ManualDispatch_GetAPICallResult(pipe, c->m_hAsyncCall, h + 1, c->m_cubParam, c->m_iCallback, &failed) ) {
+						h->call = c->m_hAsyncCall;
+						h->failed = failed;
+						h->size = c->m_cubParam;
+						queue.Push(CALL_RESULT_ID, h, (int)scratch.size());
+					}
+				}
+			} else if( callbacks.count(msg.m_iCallback) )
+				queue.Push(msg.m_iCallback, msg.m_pubParam, msg.m_cubParam);
+			SteamAPI_ManualDispatch_FreeLastCallback(pipe);
+		}
+#endif
+	}
+
+	void Run( int id, vbyte *data ) {
+		if( id == CALL_RESULT_ID ) {
+			call_result_header *h = (call_result_header*)data;
+			std::map<SteamAPICall_t, CCallbackBase*>::iterator it = calls.find(h->call);
+			if( it == calls.end() ) return;
+			CCallbackBase *cb = it->second;
+			calls.erase(it);
+			cb->Run(h + 1, h->failed != 0, h->call);
+			return;
+		}
+		std::map<int, std::vector<CCallbackBase*> >::iterator it = callbacks.find(id);
+		if( it == callbacks.end() ) return;
+		// copied : a callback might register another one
+		std::vector<CCallbackBase*> cbs = it->second;
+		for(size_t i=0;i<cbs.size();i++)
+			cbs[i]->Run(data);
+	}
+
+	// at least one callback is run per frame, a budget <= 0 runs them all
+	int Dispatch( int budget ) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		int n = 0, id, size;
+		vbyte *data;
+		while( (data = queue.Peek(&id, &size)) != NULL ) {
+			if( budget > 0 && n > 0 && std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() >= budget )
+				break;
+			queue.Pop(size);
+			n++;
+			Run(id, data);
+		}
+		return queue.count;
+	}
+};
+
+static CallbackRouter clientRouter;
+static CallbackRouter serverRouter;
+// manual dispatch applies to the whole process : once enabled for the client or the server,
+// the other one must be routed too (see run_callbacks and gameserver_runcallbacks)
+bool manual_dispatch_global = false;
+
+void route_callback( int id, CCallbackBase *cb, bool server ) {
+	(server ? serverRouter : clientRouter).callbacks[id].push_back(cb);
+}
+
+// call results are only issued by the client API. They are tracked even before manual dispatch
+// is enabled, as the ones issued at init can complete after it.
+void track_call_result( SteamAPICall_t call, CCallbackBase *cb ) {
+	if( call != k_uAPICallInvalid )
+		clientRouter.calls[call] = cb;
+}
+
+void untrack_call_result( SteamAPICall_t call ) {
+	if( call != k_uAPICallInvalid )
+		clientRouter.calls.erase(call);
+}
+
+bool manual_dispatch_init( bool server ) {
+#ifdef STEAM_MANUAL_DISPATCH
+	CallbackRouter *r = server ? &serverRouter : &clientRouter;
+	if( r->enabled ) return true;
+	if( !manual_dispatch_global ) {
+		SteamAPI_ManualDispatch_Init();
+		manual_dispatch_global = true;
+	}
+	r->Reset(true);
+	r->pipe = server ? SteamGameServer_GetHSteamPipe() : SteamAPI_GetHSteamPipe();
+	r->enabled = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void manual_dispatch_reset( bool server ) {
+	(server ? serverRouter : clientRouter).Reset();
+}
+
+bool manual_dispatch_enabled( bool server ) {
+	return (server ? serverRouter : clientRouter).enabled;
+}
+
+// returns the number of callbacks still queued
+int manual_dispatch_run( bool server, int budget ) {
+	CallbackRouter *r = server ? &serverRouter : &clientRouter;
+	if( !r->enabled ) return 0;
+	r->Poll();
+	return r->Dispatch(budget);
+}
@@ -12,6 +12,10 @@ EVENT_DECL( LobbyJoinRequest, GameLobbyJoinRequested_t )
 // networking
 EVENT_DECL( P2PSessionRequest, P2PSessionRequest_t )
 EVENT_DECL( P2PSessionConnectionFail, P2PSessionConnectFail_t )
+#ifdef STEAM_NETWORKING_MESSAGES
+EVENT_DECL( MessagesSessionRequest, SteamNetworkingMessagesSessionRequest_t )
+EVENT_DECL( MessagesSessionFailed, SteamNetworkingMessagesSessionFailed_t )
+#endif
 
 // ugc
 EVENT_DECL(DownloadItem, DownloadItemResult_t)
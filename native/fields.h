@@ -0,0 +1,33 @@
+// names of the fields set by the event encoders, hashed once at static init
+// FIELD_DECL(name) declares the HLField field_##name
+
+// common
+FIELD_DECL(active)
+FIELD_DECL(authTicket)
+FIELD_DECL(result)
+FIELD_DECL(user)
+FIELD_DECL(flags)
+
+// matchmaking
+FIELD_DECL(lobby)
+FIELD_DECL(origin)
+FIELD_DECL(type)
+FIELD_DECL(cid)
+
+// networking
+FIELD_DECL(uid)
+FIELD_DECL(error)
+FIELD_DECL(reason)
+
+// ugc
+FIELD_DECL(file)
+
+// gameserver
+FIELD_DECL(stillRetrying)
+FIELD_DECL(secure)
+FIELD_DECL(steamId)
+FIELD_DECL(ownerSteamId)
+FIELD_DECL(authSessionResponse)
+
+// end
+#undef FIELD_DECL
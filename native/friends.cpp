@@ -2,11 +2,24 @@
 
 vdynamic *CallbackHandler::EncodePersonaChange( PersonaStateChange_t *d ) {
 	HLValue ret;
-	ret.Set("user",d->m_ulSteamID);
-	ret.Set("flags", d->m_nChangeFlags);
+	ret.Set(field_user,d->m_ulSteamID);
+	ret.Set(field_flags, d->m_nChangeFlags);
 	return ret.value;
 }
 
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid user;
+	int flags;
+} persona_change_obj;
+
+void CallbackHandler::FillPersonaChange( event_obj *o, PersonaStateChange_t *d ) {
+	persona_change_obj *e = (persona_change_obj*)o;
+	hl_write_uid(e->user, d->m_ulSteamID);
+	e->flags = d->m_nChangeFlags;
+}
+
 HL_PRIM vbyte *HL_NAME(get_user_name)( vuid uid ) {
 	if( !SteamFriends() )
 		return (vbyte*)"Unknown";
@@ -45,6 +58,14 @@ HL_PRIM varray *HL_NAME(get_friends)( int flags ) {
 	return a;
 }
 
+// writes up to max friend ids, returns the number of friends
+HL_PRIM int HL_NAME(get_friend_ids)( int flags, int *out, int max ) {
+	int count = SteamFriends()->GetFriendCount(flags);
+	for(int i=0;i<count && i<max;i++)
+		out[i] = hl_intern_id(SteamFriends()->GetFriendByIndex(i,flags).ConvertToUint64());
+	return count;
+}
+
 HL_PRIM bool HL_NAME(has_friend)( vuid uid, int flags ) {
 	return SteamFriends()->HasFriend(hl_to_uid(uid),flags);
 }
@@ -64,6 +85,7 @@ DEFINE_PRIM(_BYTES, get_user_name, _UID);
 DEFINE_PRIM(_BYTES, get_user_avatar, _UID _I32 _REF(_I32) _REF(_I32));
 DEFINE_PRIM(_BOOL, request_user_information, _UID _BOOL);
 DEFINE_PRIM(_ARR, get_friends, _I32);
+DEFINE_PRIM(_I32, get_friend_ids, _I32 _BYTES _I32);
 DEFINE_PRIM(_BOOL, has_friend, _UID _I32);
 DEFINE_PRIM(_VOID, activate_overlay_user, _BYTES _UID);
 DEFINE_PRIM(_VOID, activate_overlay_store, _I32 _I32);
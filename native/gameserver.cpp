@@ -11,20 +11,45 @@ public:
 		m()
 	{}
 
-#	define EVENT_DECL(name,type) STEAM_GAMESERVER_CALLBACK(GameServerHandler, On##name, type, m_##name); vdynamic *Encode##name( type *t );
+#	define EVENT_DECL(name,type) STEAM_GAMESERVER_CALLBACK(GameServerHandler, On##name, type, m_##name); vdynamic *Encode##name( type *t ); void Fill##name( event_obj *o, type *t );
 #	include "serverevents.h"
 
+	void RouteCallbacks() {
+#		define EVENT_DECL(name,type) route_callback(type::k_iCallback, CALLBACK_BASE(&m_##name), true);
+#		include "serverevents.h"
+	}
+
 #	undef EVENT_IMPL
 #	define EVENT_IMPL(name,type) vdynamic *GameServerHandler::Encode##name( type *d )
+#	define EVENT_FILL(name,type) void GameServerHandler::Fill##name( event_obj *o, type *d )
 };
 
-#define EVENT_DECL(name,type) void GameServerHandler::On##name( type *t ) { GlobalEvent(type::k_iCallback, Encode##name(t)); }
+static TypedEvents typedEvents;
+static EventMask eventMask;
+
+// events with no server handler use the client one, as GameServer.onGlobalEvent does
+#define EVENT_DECL(name,type) void GameServerHandler::On##name( type *t ) { \
+	typed_event *e = typedEvents.Get(type::k_iCallback); \
+	if( !e ) e = s_typedEvents.Get(type::k_iCallback); \
+	int64 start = profile_start(), encoded; \
+	if( e ) { \
+		Fill##name(e->obj, t); \
+		encoded = profile_start(); \
+		TypedEvents::Call(e); \
+	} else if( eventMask.Has(type::k_iCallback) || s_eventMask.Has(type::k_iCallback) ) { \
+		vdynamic *v = Encode##name(t); \
+		encoded = profile_start(); \
+		GlobalEvent(type::k_iCallback, v); \
+	} else \
+		return; \
+	profile_callback(type::k_iCallback, true, start, encoded); \
+}
 #include "serverevents.h"
 
 EVENT_IMPL(ServerConnectFailure, SteamServerConnectFailure_t) {
 	HLValue v;
-	v.Set("result", d->m_eResult);
-	v.Set("stillRetrying", d->m_bStillRetrying);
+	v.Set(field_result, d->m_eResult);
+	v.Set(field_stillRetrying, d->m_bStillRetrying);
 	return v.value;
 }
 
@@ -34,37 +59,128 @@ EVENT_IMPL(ServersConnected, SteamServersConnected_t) {
 
 EVENT_IMPL(ServersDisconnected, SteamServersDisconnected_t) {
 	HLValue v;
-	v.Set("result", d->m_eResult);
+	v.Set(field_result, d->m_eResult);
 	return v.value;
 }
 
 EVENT_IMPL(P2PSessionRequest, P2PSessionRequest_t) {
 	HLValue v;
-	v.Set("uid", d->m_steamIDRemote);
+	v.Set(field_uid, d->m_steamIDRemote);
 	return v.value;
 }
 
 EVENT_IMPL(P2PSessionConnectFail, P2PSessionConnectFail_t) {
 	HLValue v;
-	v.Set("uid", d->m_steamIDRemote);
-	v.Set("error", d->m_eP2PSessionError);
+	v.Set(field_uid, d->m_steamIDRemote);
+	v.Set(field_error, d->m_eP2PSessionError);
+	return v.value;
+}
+
+#ifdef STEAM_NETWORKING_MESSAGES
+EVENT_IMPL(MessagesSessionRequest, SteamNetworkingMessagesSessionRequest_t) {
+	HLValue v;
+	v.Set(field_uid, d->m_identityRemote.GetSteamID());
 	return v.value;
 }
 
+EVENT_IMPL(MessagesSessionFailed, SteamNetworkingMessagesSessionFailed_t) {
+	HLValue v;
+	v.Set(field_uid, d->m_info.m_identityRemote.GetSteamID());
+	v.Set(field_error, session_error(d->m_info.m_eEndReason));
+	v.Set(field_reason, d->m_info.m_eEndReason);
+	return v.value;
+}
+#endif
+
 EVENT_IMPL(PolicyResponse, GSPolicyResponse_t) {
 	HLValue v;
-	v.Set("secure", d->m_bSecure);
+	v.Set(field_secure, d->m_bSecure);
 	return v.value;
 }
 
 EVENT_IMPL(ValidateAuthTicketResponse, ValidateAuthTicketResponse_t ) {
 	HLValue v;
-	v.Set("steamId", d->m_SteamID);
-	v.Set("ownerSteamId", d->m_OwnerSteamID);
-	v.Set("authSessionResponse",d->m_eAuthSessionResponse);
+	v.Set(field_steamId, d->m_SteamID);
+	v.Set(field_ownerSteamId, d->m_OwnerSteamID);
+	v.Set(field_authSessionResponse,d->m_eAuthSessionResponse);
 	return v.value;
 }
 
+typedef struct {
+	hl_type *t;
+	int id;
+	int result;
+	bool stillRetrying;
+} connect_failure_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	int result;
+} servers_disconnected_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	bool secure;
+} policy_response_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid steamId;
+	vuid ownerSteamId;
+	int authSessionResponse;
+} validate_ticket_obj;
+
+EVENT_FILL(ServerConnectFailure, SteamServerConnectFailure_t) {
+	connect_failure_obj *e = (connect_failure_obj*)o;
+	e->result = d->m_eResult;
+	e->stillRetrying = d->m_bStillRetrying;
+}
+
+EVENT_FILL(ServersConnected, SteamServersConnected_t) {
+}
+
+EVENT_FILL(ServersDisconnected, SteamServersDisconnected_t) {
+	((servers_disconnected_obj*)o)->result = d->m_eResult;
+}
+
+EVENT_FILL(P2PSessionRequest, P2PSessionRequest_t) {
+	hl_write_uid(((session_request_obj*)o)->uid, d->m_steamIDRemote.ConvertToUint64());
+}
+
+EVENT_FILL(P2PSessionConnectFail, P2PSessionConnectFail_t) {
+	session_failed_obj *e = (session_failed_obj*)o;
+	hl_write_uid(e->uid, d->m_steamIDRemote.ConvertToUint64());
+	e->error = d->m_eP2PSessionError;
+	e->reason = 0;
+}
+
+#ifdef STEAM_NETWORKING_MESSAGES
+EVENT_FILL(MessagesSessionRequest, SteamNetworkingMessagesSessionRequest_t) {
+	hl_write_uid(((session_request_obj*)o)->uid, d->m_identityRemote.GetSteamID64());
+}
+
+EVENT_FILL(MessagesSessionFailed, SteamNetworkingMessagesSessionFailed_t) {
+	session_failed_obj *e = (session_failed_obj*)o;
+	hl_write_uid(e->uid, d->m_info.m_identityRemote.GetSteamID64());
+	e->error = session_error(d->m_info.m_eEndReason);
+	e->reason = d->m_info.m_eEndReason;
+}
+#endif
+
+EVENT_FILL(PolicyResponse, GSPolicyResponse_t) {
+	((policy_response_obj*)o)->secure = d->m_bSecure != 0;
+}
+
+EVENT_FILL(ValidateAuthTicketResponse, ValidateAuthTicketResponse_t ) {
+	validate_ticket_obj *e = (validate_ticket_obj*)o;
+	hl_write_uid(e->steamId, d->m_SteamID.ConvertToUint64());
+	hl_write_uid(e->ownerSteamId, d->m_OwnerSteamID.ConvertToUint64());
+	e->authSessionResponse = d->m_eAuthSessionResponse;
+}
+
 static GameServerHandler *serverHandler = NULL;
 static vclosure *globalEvent = NULL;
 
@@ -84,16 +200,46 @@ HL_PRIM void HL_NAME(gameserver_setup)( vclosure *onGlobalEvent ){
 	hl_add_root(&globalEvent);
 }
 
+HL_PRIM void HL_NAME(gameserver_register_typed_event)( int id, event_obj *obj, vclosure *callb ) {
+	typedEvents.Register(id, obj, callb);
+}
+
+HL_PRIM void HL_NAME(gameserver_subscribe_event)( int id, bool b ) {
+	eventMask.Set(id, b);
+}
+
 bool HL_NAME(gameserver_init)( int ip, int port, int gameport, int queryport, int serverMode, char *version ) {
 	return SteamGameServer_Init(ip,port,gameport,queryport,(EServerMode)serverMode, version);
 }
 
+bool HL_NAME(gameserver_init_manual_dispatch)();
+
 void HL_NAME(gameserver_runcallbacks)() {
-	SteamGameServer_RunCallbacks();
+	// enabled by the client, manual dispatch also applies to the game server
+	if( manual_dispatch_global && !manual_dispatch_enabled(true) )
+		HL_NAME(gameserver_init_manual_dispatch)();
+	if( manual_dispatch_enabled(true) )
+		manual_dispatch_run(true, 0);
+	else
+		SteamGameServer_RunCallbacks();
+}
+
+// same as init_manual_dispatch, to call after gameserver_setup
+bool HL_NAME(gameserver_init_manual_dispatch)() {
+	if( !serverHandler ) return false;
+	if( manual_dispatch_enabled(true) ) return true;
+	if( !manual_dispatch_init(true) ) return false;
+	serverHandler->RouteCallbacks();
+	return true;
+}
+
+int HL_NAME(gameserver_run_manual_callbacks)( int budget ) {
+	return manual_dispatch_run(true, budget);
 }
 
 void HL_NAME(gameserver_shutdown)() {
 	SteamGameServer_Shutdown();
+	manual_dispatch_reset(true);
 }
 
 void HL_NAME(gameserver_logon_anonymous)() {
@@ -129,7 +275,11 @@ int HL_NAME(gameserver_get_public_ip)() {
 
 DEFINE_PRIM(_BOOL, gameserver_init, _I32 _I32 _I32 _I32 _I32 _BYTES);
 DEFINE_PRIM(_VOID, gameserver_setup, _FUN(_VOID, _I32 _DYN));
+DEFINE_PRIM(_VOID, gameserver_register_typed_event, _I32 _EVENT _FUN(_VOID, _EVENT));
+DEFINE_PRIM(_VOID, gameserver_subscribe_event, _I32 _BOOL);
 DEFINE_PRIM(_VOID, gameserver_runcallbacks, _NO_ARG);
+DEFINE_PRIM(_BOOL, gameserver_init_manual_dispatch, _NO_ARG);
+DEFINE_PRIM(_I32, gameserver_run_manual_callbacks, _I32);
 DEFINE_PRIM(_VOID, gameserver_shutdown, _NO_ARG);
 DEFINE_PRIM(_VOID, gameserver_logon_anonymous, _NO_ARG);
 DEFINE_PRIM(_VOID, gameserver_enable_heartbeats, _BOOL);
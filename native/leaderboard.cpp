@@ -0,0 +1,152 @@
+#include "steamwrap.h"
+
+// Leaderboard requests : every find, upload and download has its own call result and closure (see ASYNC_CALL),
+// so any number of them can be pending at once.
+
+// Boards are registered once by name and then designated by their index : the handle is set when the
+// board is found, or restored from the previous session (see Leaderboard.cacheFile) and verified in the background.
+typedef struct {
+	std::string name;
+	SteamLeaderboard_t handle;
+} leaderboard_board;
+
+static std::vector<leaderboard_board> s_boards;
+
+static SteamLeaderboard_t board_handle( int board ) {
+	return board >= 0 && board < (int)s_boards.size() ? s_boards[board].handle : 0;
+}
+
+HL_PRIM int HL_NAME(register_leaderboard)( vbyte *name ) {
+	for(int i=0;i<(int)s_boards.size();i++)
+		if( s_boards[i].name == (char*)name )
+			return i;
+	leaderboard_board b;
+	b.name = (char*)name;
+	b.handle = 0;
+	s_boards.push_back(b);
+	return (int)s_boards.size() - 1;
+}
+
+HL_PRIM vuid HL_NAME(get_leaderboard_handle)( int board ) {
+	SteamLeaderboard_t h = board_handle(board);
+	return h ? hl_of_uint64(h) : NULL;
+}
+
+HL_PRIM void HL_NAME(set_leaderboard_handle)( int board, vuid handle ) {
+	if( board < 0 || board >= (int)s_boards.size() ) return;
+	s_boards[board].handle = handle ? hl_to_uint64(handle) : 0;
+}
+
+// Downloaded entries are decoded as arrays : count 64 bits steam ids, count ranks, count scores,
+// count + 1 positions in the details (the details of entry i are [pos[i], pos[i+1]) ), then the details of all the entries
+static vbyte *encode_leaderboard_entries( SteamLeaderboardEntries_t handle, int count ) {
+	static std::vector<LeaderboardEntry_t> entries;
+	static std::vector<int32> details;
+	entries.resize(count);
+	details.resize((size_t)count * k_cLeaderboardDetailsMax);
+	int detailsCount = 0;
+	for(int i=0;i<count;i++) {
+		LeaderboardEntry_t *e = &entries[i];
+		if( !SteamUserStats()->GetDownloadedLeaderboardEntry(handle, i, e, &details[detailsCount], k_cLeaderboardDetailsMax) )
+			*e = LeaderboardEntry_t();
+		if( e->m_cDetails > k_cLeaderboardDetailsMax ) e->m_cDetails = k_cLeaderboardDetailsMax;
+		if( e->m_cDetails < 0 ) e->m_cDetails = 0;
+		detailsCount += e->m_cDetails;
+	}
+	vbyte *data = hl_alloc_bytes(count * 20 + 4 + detailsCount * 4);
+	uint64 *users = (uint64*)data;
+	int *ranks = (int*)(users + count);
+	int *scores = ranks + count;
+	int *pos = scores + count;
+	int p = 0;
+	for(int i=0;i<count;i++) {
+		LeaderboardEntry_t *e = &entries[i];
+		users[i] = e->m_steamIDUser.ConvertToUint64();
+		ranks[i] = e->m_nGlobalRank;
+		scores[i] = e->m_nScore;
+		pos[i] = p;
+		p += e->m_cDetails;
+	}
+	pos[count] = p;
+	if( detailsCount ) memcpy(pos + count + 1, &details[0], detailsCount * 4);
+	return data;
+}
+
+static void on_leaderboard_found( vclosure *c, LeaderboardFindResult_t *result, bool error ) {
+	bool found = !error && result->m_bLeaderboardFound;
+	if( found ) {
+		const char *name = SteamUserStats()->GetLeaderboardName(result->m_hSteamLeaderboard);
+		for(int i=0;i<(int)s_boards.size();i++)
+			if( s_boards[i].name == name )
+				s_boards[i].handle = result->m_hSteamLeaderboard;
+	}
+	if( c->hasValue )
+		((void(*)(void*, bool, bool))c->fun)(c->value, found, error);
+	else
+		((void(*)(bool, bool))c->fun)(found, error);
+}
+
+HL_PRIM CClosureCallResult<LeaderboardFindResult_t>* HL_NAME(find_leaderboard)( int board, vclosure *closure ) {
+	if( !CheckInit() || board < 0 || board >= (int)s_boards.size() ) return NULL;
+	ASYNC_CALL(SteamUserStats()->FindLeaderboard(s_boards[board].name.c_str()), LeaderboardFindResult_t, on_leaderboard_found);
+	return m_call;
+}
+
+static void on_score_uploaded( vclosure *c, LeaderboardScoreUploaded_t *result, bool error ) {
+	bool ok = !error && result->m_bSuccess;
+	int score = ok ? result->m_nScore : 0;
+	int rank = ok ? result->m_nGlobalRankNew : 0;
+	int previousRank = ok ? result->m_nGlobalRankPrevious : 0;
+	bool changed = ok && result->m_bScoreChanged;
+	if( c->hasValue )
+		((void(*)(void*, bool, int, int, int, bool))c->fun)(c->value, ok, score, rank, previousRank, changed);
+	else
+		((void(*)(bool, int, int, int, bool))c->fun)(ok, score, rank, previousRank, changed);
+}
+
+HL_PRIM CClosureCallResult<LeaderboardScoreUploaded_t>* HL_NAME(upload_leaderboard_score)( int board, int method, int score, vbyte *details, int detailsCount, vclosure *closure ) {
+	if( !CheckInit() || !board_handle(board) ) return NULL;
+	if( detailsCount > k_cLeaderboardDetailsMax ) detailsCount = k_cLeaderboardDetailsMax;
+	ASYNC_CALL(SteamUserStats()->UploadLeaderboardScore(board_handle(board), (ELeaderboardUploadScoreMethod)method, score, (int32*)details, detailsCount), LeaderboardScoreUploaded_t, on_score_uploaded);
+	return m_call;
+}
+
+static void on_scores_downloaded( vclosure *c, LeaderboardScoresDownloaded_t *result, bool error ) {
+	int count = error ? 0 : result->m_cEntryCount;
+	vbyte *entries = error ? NULL : encode_leaderboard_entries(result->m_hSteamLeaderboardEntries, count);
+	if( c->hasValue )
+		((void(*)(void*, vbyte*, int, bool))c->fun)(c->value, entries, count, error);
+	else
+		((void(*)(vbyte*, int, bool))c->fun)(entries, count, error);
+}
+
+HL_PRIM CClosureCallResult<LeaderboardScoresDownloaded_t>* HL_NAME(download_leaderboard_entries)( int board, int request, int start, int end, vclosure *closure ) {
+	if( !CheckInit() || !board_handle(board) ) return NULL;
+	ASYNC_CALL(SteamUserStats()->DownloadLeaderboardEntries(board_handle(board), (ELeaderboardDataRequest)request, start, end), LeaderboardScoresDownloaded_t, on_scores_downloaded);
+	return m_call;
+}
+
+// up to 100 users per request, the users without an entry are skipped
+HL_PRIM CClosureCallResult<LeaderboardScoresDownloaded_t>* HL_NAME(download_leaderboard_users)( int board, vbyte *users, int count, vclosure *closure ) {
+	if( !CheckInit() || !board_handle(board) ) return NULL;
+	static std::vector<CSteamID> ids;
+	ids.resize(count);
+	for(int i=0;i<count;i++)
+		ids[i] = hl_to_uid(users + i * 8);
+	ASYNC_CALL(SteamUserStats()->DownloadLeaderboardEntriesForUsers(board_handle(board), count ? &ids[0] : NULL, count), LeaderboardScoresDownloaded_t, on_scores_downloaded);
+	return m_call;
+}
+
+HL_PRIM int HL_NAME(get_leaderboard_entry_count)( int board ) {
+	if( !CheckInit() || !board_handle(board) ) return 0;
+	return SteamUserStats()->GetLeaderboardEntryCount(board_handle(board));
+}
+
+DEFINE_PRIM(_I32, register_leaderboard, _BYTES);
+DEFINE_PRIM(_UID, get_leaderboard_handle, _I32);
+DEFINE_PRIM(_VOID, set_leaderboard_handle, _I32 _UID);
+DEFINE_PRIM(_CRESULT, find_leaderboard, _I32 _FUN(_VOID, _BOOL _BOOL));
+DEFINE_PRIM(_CRESULT, upload_leaderboard_score, _I32 _I32 _I32 _BYTES _I32 _FUN(_VOID, _BOOL _I32 _I32 _I32 _BOOL));
+DEFINE_PRIM(_CRESULT, download_leaderboard_entries, _I32 _I32 _I32 _I32 _FUN(_VOID, _BYTES _I32 _BOOL));
+DEFINE_PRIM(_CRESULT, download_leaderboard_users, _I32 _BYTES _I32 _FUN(_VOID, _BYTES _I32 _BOOL));
+DEFINE_PRIM(_I32, get_leaderboard_entry_count, _I32);
@@ -3,36 +3,99 @@
 vdynamic *CallbackHandler::EncodeLobbyData( LobbyDataUpdate_t *d ) {
 	if( !d->m_bSuccess ) return NULL;
 	HLValue ret;
-	ret.Set("lobby",d->m_ulSteamIDLobby);
-	if( d->m_ulSteamIDMember != d->m_ulSteamIDLobby ) ret.Set("user",d->m_ulSteamIDMember);
+	ret.Set(field_lobby,d->m_ulSteamIDLobby);
+	if( d->m_ulSteamIDMember != d->m_ulSteamIDLobby ) ret.Set(field_user,d->m_ulSteamIDMember);
 	return ret.value;
 }
 
 vdynamic *CallbackHandler::EncodeLobbyChatUpdate( LobbyChatUpdate_t *d ) {
 	HLValue ret;
-	ret.Set("lobby",d->m_ulSteamIDLobby);
-	ret.Set("user",d->m_ulSteamIDUserChanged);
-	ret.Set("origin", d->m_ulSteamIDMakingChange);
-	ret.Set("flags", d->m_rgfChatMemberStateChange);
+	ret.Set(field_lobby,d->m_ulSteamIDLobby);
+	ret.Set(field_user,d->m_ulSteamIDUserChanged);
+	ret.Set(field_origin, d->m_ulSteamIDMakingChange);
+	ret.Set(field_flags, d->m_rgfChatMemberStateChange);
 	return ret.value;
 }
 
 vdynamic *CallbackHandler::EncodeLobbyChatMsg( LobbyChatMsg_t *d ) {
 	HLValue ret;
-	ret.Set("lobby",d->m_ulSteamIDLobby);
-	ret.Set("user",d->m_ulSteamIDUser);
-	ret.Set("type",d->m_eChatEntryType);
-	ret.Set("cid", d->m_iChatID);
+	ret.Set(field_lobby,d->m_ulSteamIDLobby);
+	ret.Set(field_user,d->m_ulSteamIDUser);
+	ret.Set(field_type,d->m_eChatEntryType);
+	ret.Set(field_cid, d->m_iChatID);
 	return ret.value;
 }
 
 vdynamic *CallbackHandler::EncodeLobbyJoinRequest( GameLobbyJoinRequested_t *d ) {
 	HLValue ret;
-	ret.Set("lobby", d->m_steamIDLobby);
-	ret.Set("user", d->m_steamIDFriend);
+	ret.Set(field_lobby, d->m_steamIDLobby);
+	ret.Set(field_user, d->m_steamIDFriend);
 	return ret.value;
 }
 
+// user is the lobby itself when the lobby data changed
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid lobby;
+	vuid user;
+	bool success;
+} lobby_data_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid lobby;
+	vuid user;
+	vuid origin;
+	int flags;
+} lobby_chat_update_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid lobby;
+	vuid user;
+	int type;
+	int cid;
+} lobby_chat_msg_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid lobby;
+	vuid user;
+} lobby_join_request_obj;
+
+void CallbackHandler::FillLobbyData( event_obj *o, LobbyDataUpdate_t *d ) {
+	lobby_data_obj *e = (lobby_data_obj*)o;
+	hl_write_uid(e->lobby, d->m_ulSteamIDLobby);
+	hl_write_uid(e->user, d->m_ulSteamIDMember);
+	e->success = d->m_bSuccess != 0;
+}
+
+void CallbackHandler::FillLobbyChatUpdate( event_obj *o, LobbyChatUpdate_t *d ) {
+	lobby_chat_update_obj *e = (lobby_chat_update_obj*)o;
+	hl_write_uid(e->lobby, d->m_ulSteamIDLobby);
+	hl_write_uid(e->user, d->m_ulSteamIDUserChanged);
+	hl_write_uid(e->origin, d->m_ulSteamIDMakingChange);
+	e->flags = d->m_rgfChatMemberStateChange;
+}
+
+void CallbackHandler::FillLobbyChatMsg( event_obj *o, LobbyChatMsg_t *d ) {
+	lobby_chat_msg_obj *e = (lobby_chat_msg_obj*)o;
+	hl_write_uid(e->lobby, d->m_ulSteamIDLobby);
+	hl_write_uid(e->user, d->m_ulSteamIDUser);
+	e->type = d->m_eChatEntryType;
+	e->cid = d->m_iChatID;
+}
+
+void CallbackHandler::FillLobbyJoinRequest( event_obj *o, GameLobbyJoinRequested_t *d ) {
+	lobby_join_request_obj *e = (lobby_join_request_obj*)o;
+	hl_write_uid(e->lobby, d->m_steamIDLobby.ConvertToUint64());
+	hl_write_uid(e->user, d->m_steamIDFriend.ConvertToUint64());
+}
+
 // --------- Lobby Search --------------------------
 
 static void on_lobby_list( vclosure *c, LobbyMatchList_t *result, bool error ) {
@@ -143,6 +206,19 @@ HL_PRIM vuid HL_NAME(get_lobby_chat_entry)( vuid uid, int cid, vbyte *data, int
 	return hl_of_uid(user);
 }
 
+// writes up to max member ids, returns the number of members
+HL_PRIM int HL_NAME(get_lobby_member_ids)( vuid uid, int *out, int max ) {
+	CSteamID lobby = hl_to_uid(uid);
+	int count = SteamMatchmaking()->GetNumLobbyMembers(lobby);
+	for(int i=0;i<count && i<max;i++)
+		out[i] = hl_intern_id(SteamMatchmaking()->GetLobbyMemberByIndex(lobby,i).ConvertToUint64());
+	return count;
+}
+
+HL_PRIM int HL_NAME(get_lobby_owner_id)( vuid uid ) {
+	return hl_intern_id(SteamMatchmaking()->GetLobbyOwner(hl_to_uid(uid)).ConvertToUint64());
+}
+
 HL_PRIM bool HL_NAME(lobby_invite_user)( vuid lid, vuid fid ) {
 	return SteamMatchmaking()->InviteUserToLobby(hl_to_uid(lid),hl_to_uid(fid));
 }
@@ -161,10 +237,12 @@ DEFINE_PRIM(_CRESULT, join_lobby, _UID _CALLB(_BOOL));
 
 DEFINE_PRIM(_I32, get_num_lobby_members, _UID);
 DEFINE_PRIM(_UID, get_lobby_member_by_index, _UID _I32);
+DEFINE_PRIM(_I32, get_lobby_member_ids, _UID _BYTES _I32);
 DEFINE_PRIM(_I32, get_lobby_member_limit, _UID);
 DEFINE_PRIM(_VOID, set_lobby_member_limit, _UID _I32);
 
 DEFINE_PRIM(_UID, get_lobby_owner, _UID);
+DEFINE_PRIM(_ID, get_lobby_owner_id, _UID);
 DEFINE_PRIM(_VOID, lobby_invite_friends, _UID);
 DEFINE_PRIM(_BOOL, lobby_invite_user, _UID _UID);
 DEFINE_PRIM(_BOOL, send_lobby_chat_msg, _UID _BYTES _I32);
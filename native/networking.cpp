@@ -1,42 +1,1512 @@
 #include "steamwrap.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <deque>
+#ifdef HL_WIN
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
 
 #define Networking()	(SteamNetworking() ? SteamNetworking() : SteamGameServerNetworking())
+#ifdef STEAM_NETWORKING_MESSAGES
+#define NetworkingMessages()	(SteamNetworkingMessages() ? SteamNetworkingMessages() : SteamGameServerNetworkingMessages())
+#endif
+
+static double p2p_time() {
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Backends
+//-----------------------------------------------------------------------------------------------------------
+
+typedef enum {
+	SteamP2P,
+	SteamMessages,
+	Loopback,
+} p2p_backend_id;
+
+class P2PBackend {
+public:
+	virtual ~P2PBackend() {}
+	virtual bool Send( CSteamID uid, const void *data, uint32 size, int type, int channel ) = 0;
+	virtual bool IsAvailable( uint32 *size, int channel ) = 0;
+	virtual bool Read( void *data, uint32 maxSize, uint32 *size, CSteamID *uid, double *time, int channel ) = 0;
+	virtual bool Accept( CSteamID uid ) = 0;
+	virtual bool Close( CSteamID uid ) = 0;
+	virtual bool GetState( CSteamID uid, P2PSessionState_t *state ) = 0;
+	// round trip time in milliseconds, -1 if the backend does not measure it
+	virtual int GetPing( CSteamID uid ) {
+		return -1;
+	}
+};
+
+class SteamP2PBackend : public P2PBackend {
+public:
+	bool Send( CSteamID uid, const void *data, uint32 size, int type, int channel ) {
+		return Networking()->SendP2PPacket(uid, data, size, (EP2PSend)type, channel);
+	}
+	bool IsAvailable( uint32 *size, int channel ) {
+		return Networking()->IsP2PPacketAvailable(size, channel);
+	}
+	bool Read( void *data, uint32 maxSize, uint32 *size, CSteamID *uid, double *time, int channel ) {
+		*time = p2p_time();
+		return Networking()->ReadP2PPacket(data, maxSize, size, uid, channel);
+	}
+	bool Accept( CSteamID uid ) {
+		return Networking()->AcceptP2PSessionWithUser(uid);
+	}
+	bool Close( CSteamID uid ) {
+		return Networking()->CloseP2PSessionWithUser(uid);
+	}
+	bool GetState( CSteamID uid, P2PSessionState_t *state ) {
+		return Networking()->GetP2PSessionState(uid, state);
+	}
+};
+
+#ifdef STEAM_NETWORKING_MESSAGES
+
+#define P2P_MESSAGES_BATCH	64
+
+static SteamNetworkingIdentity to_identity( CSteamID uid ) {
+	SteamNetworkingIdentity id;
+	id.SetSteamID(uid);
+	return id;
+}
+
+class MessagesBackend : public P2PBackend {
+	// messages received in batch and not read yet, per channel
+	typedef struct {
+		SteamNetworkingMessage_t *msgs[P2P_MESSAGES_BATCH];
+		int pos;
+		int count;
+	} inbox;
+	// the channels < 32 can be polled by the receive thread : their inboxes are fixed, the map is only used by the main thread
+	inbox polled[32];
+	std::map<int, inbox> others;
+	inbox *Inbox( int channel ) {
+		return channel >= 0 && channel < 32 ? &polled[channel] : &others[channel];
+	}
+public:
+	MessagesBackend() {
+		memset(polled, 0, sizeof(polled));
+	}
+	SteamNetworkingMessage_t *Peek( int channel ) {
+		inbox *in = Inbox(channel);
+		if( in->pos == in->count ) {
+			int n = NetworkingMessages()->ReceiveMessagesOnChannel(channel, in->msgs, P2P_MESSAGES_BATCH);
+			in->pos = 0;
+			in->count = n < 0 ? 0 : n;
+		}
+		return in->pos < in->count ? in->msgs[in->pos] : NULL;
+	}
+	// the caller owns the message and must Release() it
+	SteamNetworkingMessage_t *Take( int channel ) {
+		SteamNetworkingMessage_t *m = Peek(channel);
+		if( m ) Inbox(channel)->pos++;
+		return m;
+	}
+	double Time( SteamNetworkingMessage_t *m ) {
+		return p2p_time() - (SteamNetworkingUtils()->GetLocalTimestamp() - m->m_usecTimeReceived) * 1e-6;
+	}
+	bool Send( CSteamID uid, const void *data, uint32 size, int type, int channel ) {
+		int flags;
+		switch( type ) {
+		case k_EP2PSendUnreliable: flags = k_nSteamNetworkingSend_Unreliable; break;
+		case k_EP2PSendUnreliableNoDelay: flags = k_nSteamNetworkingSend_UnreliableNoDelay; break;
+		case k_EP2PSendReliable: flags = k_nSteamNetworkingSend_ReliableNoNagle; break;
+		default: flags = k_nSteamNetworkingSend_Reliable; break;
+		}
+		return NetworkingMessages()->SendMessageToUser(to_identity(uid), data, size, flags | k_nSteamNetworkingSend_AutoRestartBrokenSession, channel) == k_EResultOK;
+	}
+	bool IsAvailable( uint32 *size, int channel ) {
+		SteamNetworkingMessage_t *m = Peek(channel);
+		if( !m ) return false;
+		*size = m->m_cbSize;
+		return true;
+	}
+	bool Read( void *data, uint32 maxSize, uint32 *size, CSteamID *uid, double *time, int channel ) {
+		SteamNetworkingMessage_t *m = Take(channel);
+		if( !m ) return false;
+		*size = (uint32)m->m_cbSize < maxSize ? m->m_cbSize : maxSize;
+		*uid = m->m_identityPeer.GetSteamID();
+		*time = Time(m);
+		memcpy(data, m->m_pData, *size);
+		m->Release();
+		return true;
+	}
+	bool Accept( CSteamID uid ) {
+		return NetworkingMessages()->AcceptSessionWithUser(to_identity(uid));
+	}
+	bool Close( CSteamID uid ) {
+		return NetworkingMessages()->CloseSessionWithUser(to_identity(uid));
+	}
+	bool GetState( CSteamID uid, P2PSessionState_t *state ) {
+		SteamNetConnectionInfo_t info;
+		SteamNetConnectionRealTimeStatus_t status;
+		ESteamNetworkingConnectionState s = NetworkingMessages()->GetSessionConnectionInfo(to_identity(uid), &info, &status);
+		if( s == k_ESteamNetworkingConnectionState_None )
+			return false;
+		memset(state, 0, sizeof(P2PSessionState_t));
+		state->m_bConnecting = s == k_ESteamNetworkingConnectionState_Connecting || s == k_ESteamNetworkingConnectionState_FindingRoute;
+		state->m_bConnectionActive = s == k_ESteamNetworkingConnectionState_Connected;
+		state->m_bUsingRelay = (info.m_nFlags & k_nSteamNetConnectionInfoFlags_Relayed) != 0;
+		state->m_nBytesQueuedForSend = status.m_cbPendingUnreliable + status.m_cbPendingReliable;
+		return true;
+	}
+	int GetPing( CSteamID uid ) {
+		SteamNetConnectionRealTimeStatus_t status;
+		if( NetworkingMessages()->GetSessionConnectionInfo(to_identity(uid), NULL, &status) != k_ESteamNetworkingConnectionState_Connected )
+			return -1;
+		return status.m_nPing;
+	}
+};
+
+static MessagesBackend messages_backend;
+
+// P2PSessionConnectFail_t error for a session end reason
+int session_error( int reason ) {
+	return reason == k_ESteamNetConnectionEnd_Misc_Timeout ? 4 /* k_EP2PSessionErrorTimeout */ : 0;
+}
+
+vdynamic *CallbackHandler::EncodeMessagesSessionRequest( SteamNetworkingMessagesSessionRequest_t *d ) {
+	HLValue v;
+	v.Set(field_uid, d->m_identityRemote.GetSteamID());
+	return v.value;
+}
+
+vdynamic *CallbackHandler::EncodeMessagesSessionFailed( SteamNetworkingMessagesSessionFailed_t *d ) {
+	HLValue v;
+	v.Set(field_uid, d->m_info.m_identityRemote.GetSteamID());
+	v.Set(field_error, session_error(d->m_info.m_eEndReason));
+	v.Set(field_reason, d->m_info.m_eEndReason);
+	return v.value;
+}
+
+void CallbackHandler::FillMessagesSessionRequest( event_obj *o, SteamNetworkingMessagesSessionRequest_t *d ) {
+	hl_write_uid(((session_request_obj*)o)->uid, d->m_identityRemote.GetSteamID64());
+}
+
+void CallbackHandler::FillMessagesSessionFailed( event_obj *o, SteamNetworkingMessagesSessionFailed_t *d ) {
+	session_failed_obj *e = (session_failed_obj*)o;
+	hl_write_uid(e->uid, d->m_info.m_identityRemote.GetSteamID64());
+	e->error = session_error(d->m_info.m_eEndReason);
+	e->reason = d->m_info.m_eEndReason;
+}
+
+#endif
+
+// In-process transport : packets sent to any peer are received locally as if that peer had sent them,
+// so that the netcode can run and be benchmarked without a Steam client.
+class LoopbackBackend : public P2PBackend {
+	typedef struct {
+		CSteamID uid;
+		std::vector<vbyte> data;
+	} packet;
+	std::mutex lock;
+	std::map<int, std::deque<packet> > channels;
+	std::vector<std::vector<vbyte> > pool;
+public:
+	bool Send( CSteamID uid, const void *data, uint32 size, int type, int channel ) {
+		std::lock_guard<std::mutex> l(lock);
+		std::deque<packet> &q = channels[channel];
+		q.push_back(packet());
+		q.back().uid = uid;
+		if( !pool.empty() ) {
+			q.back().data.swap(pool.back());
+			pool.pop_back();
+		}
+		q.back().data.assign((const vbyte*)data, (const vbyte*)data + size);
+		return true;
+	}
+	bool IsAvailable( uint32 *size, int channel ) {
+		std::lock_guard<std::mutex> l(lock);
+		std::map<int, std::deque<packet> >::iterator it = channels.find(channel);
+		if( it == channels.end() || it->second.empty() )
+			return false;
+		*size = (uint32)it->second.front().data.size();
+		return true;
+	}
+	bool Read( void *data, uint32 maxSize, uint32 *size, CSteamID *uid, double *time, int channel ) {
+		std::lock_guard<std::mutex> l(lock);
+		std::map<int, std::deque<packet> >::iterator it = channels.find(channel);
+		if( it == channels.end() || it->second.empty() )
+			return false;
+		packet &p = it->second.front();
+		// like ReadP2PPacket, the packet is truncated if the buffer is too small
+		*size = (uint32)p.data.size() < maxSize ? (uint32)p.data.size() : maxSize;
+		if( *size )
+			memcpy(data, &p.data[0], *size);
+		*uid = p.uid;
+		*time = p2p_time();
+		pool.push_back(std::vector<vbyte>());
+		pool.back().swap(p.data);
+		it->second.pop_front();
+		return true;
+	}
+	bool Accept( CSteamID uid ) {
+		return true;
+	}
+	bool Close( CSteamID uid ) {
+		return true;
+	}
+	bool GetState( CSteamID uid, P2PSessionState_t *state ) {
+		memset(state, 0, sizeof(P2PSessionState_t));
+		state->m_bConnectionActive = 1;
+		return true;
+	}
+};
+
+static LoopbackBackend loopback_backend;
+static SteamP2PBackend steam_p2p_backend;
+static P2PBackend *backend = &steam_p2p_backend;
+static p2p_backend_id backend_id = SteamP2P;
+
+//-----------------------------------------------------------------------------------------------------------
+// Capture & replay
+//-----------------------------------------------------------------------------------------------------------
+
+class MappedFile {
+#ifdef HL_WIN
+	HANDLE file;
+	HANDLE map;
+#else
+	int fd;
+#endif
+public:
+	vbyte *data;
+	uint64 size;
+
+	MappedFile() : data(NULL), size(0) {
+#ifdef HL_WIN
+		file = map = NULL;
+#else
+		fd = -1;
+#endif
+	}
+
+	// size is only used when writing : the file is created with this size
+	bool Open( const char *path, uint64 size, bool write ) {
+#ifdef HL_WIN
+		file = CreateFileA(path, write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL, write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if( file == INVALID_HANDLE_VALUE ) {
+			file = NULL;
+			return false;
+		}
+		if( !write ) {
+			LARGE_INTEGER len;
+			GetFileSizeEx(file, &len);
+			size = len.QuadPart;
+		}
+		map = size ? CreateFileMappingA(file, NULL, write ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, NULL) : NULL;
+		data = map ? (vbyte*)MapViewOfFile(map, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size) : NULL;
+#else
+		fd = open(path, write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+		if( fd < 0 )
+			return false;
+		if( write ) {
+			if( ftruncate(fd, size) != 0 )
+				size = 0;
+		} else {
+			struct stat st;
+			fstat(fd, &st);
+			size = st.st_size;
+		}
+		void *ptr = size ? mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		data = ptr == MAP_FAILED ? NULL : (vbyte*)ptr;
+#endif
+		this->size = size;
+		if( !data ) {
+			Close(size);
+			return false;
+		}
+		return true;
+	}
+
+	// unmaps the file, truncated to length bytes
+	void Close( uint64 length ) {
+#ifdef HL_WIN
+		if( data ) UnmapViewOfFile(data);
+		if( map ) CloseHandle(map);
+		if( file ) {
+			if( length < size ) {
+				LARGE_INTEGER pos;
+				pos.QuadPart = length;
+				SetFilePointerEx(file, pos, NULL, FILE_BEGIN);
+				SetEndOfFile(file);
+			}
+			CloseHandle(file);
+		}
+		file = map = NULL;
+#else
+		if( data ) munmap(data, size);
+		if( fd >= 0 ) {
+			if( length < size && ftruncate(fd, length) != 0 )
+				printf("[HLSTEAM] Failed to truncate capture file\n");
+			close(fd);
+		}
+		fd = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+};
+
+// Capture files start with a header, followed by one record per packet sent or received,
+// each one aligned on 8 bytes and followed by its payload.
+#define P2P_CAPTURE_MAGIC		0x43503248 // "H2PC"
+#define P2P_CAPTURE_VERSION		1
+#define P2P_CAPTURE_RECEIVED	1
+
+typedef struct {
+	int magic;
+	int version;
+	uint64 length; // set when the capture is stopped, 0 if it was interrupted
+} p2p_capture_header;
+
+typedef struct {
+	uint32 size; // record size, 0 marks the end of an interrupted capture
+	uint32 length;
+	int channel;
+	int flags; // P2P_CAPTURE_RECEIVED | send type << 1
+	uint64 uid;
+	double time;
+} p2p_capture_record;
+
+// Records the traffic of the backend it wraps. Records are reserved with an atomic compare and swap
+// and written in place in the mapped file, so that the network thread and the main thread can both append.
+class CaptureBackend : public P2PBackend {
+	MappedFile file;
+	std::atomic<uint64> pos;
+public:
+	P2PBackend *inner;
+	std::atomic<int> dropped;
+
+	bool Open( const char *path, uint64 maxSize ) {
+		if( maxSize < sizeof(p2p_capture_header) || !file.Open(path, maxSize, true) )
+			return false;
+		p2p_capture_header *h = (p2p_capture_header*)file.data;
+		h->magic = P2P_CAPTURE_MAGIC;
+		h->version = P2P_CAPTURE_VERSION;
+		h->length = 0;
+		pos.store(sizeof(p2p_capture_header));
+		dropped.store(0);
+		return true;
+	}
+	uint64 Close() {
+		uint64 length = pos.load();
+		if( length > file.size )
+			length = file.size;
+		((p2p_capture_header*)file.data)->length = length;
+		file.Close(length);
+		return length;
+	}
+	void Record( CSteamID uid, const void *data, uint32 length, int channel, int flags, double time ) {
+		uint32 size = (sizeof(p2p_capture_record) + length + 7) & ~7;
+		// only reserved if it fits, so that the records stay contiguous when the file is full
+		uint64 p = pos.load();
+		do {
+			if( p + size > file.size ) {
+				dropped.fetch_add(1);
+				return;
+			}
+		} while( !pos.compare_exchange_weak(p, p + size) );
+		p2p_capture_record *r = (p2p_capture_record*)(file.data + p);
+		r->length = length;
+		r->channel = channel;
+		r->flags = flags;
+		r->uid = uid.ConvertToUint64();
+		r->time = time;
+		memcpy(r + 1, data, length);
+		r->size = size;
+	}
+	bool Send( CSteamID uid, const void *data, uint32 size, int type, int channel ) {
+		Record(uid, data, size, channel, type << 1, p2p_time());
+		return inner->Send(uid, data, size, type, channel);
+	}
+	bool IsAvailable( uint32 *size, int channel ) {
+		return inner->IsAvailable(size, channel);
+	}
+	bool Read( void *data, uint32 maxSize, uint32 *size, CSteamID *uid, double *time, int channel ) {
+		if( !inner->Read(data, maxSize, size, uid, time, channel) )
+			return false;
+		Record(*uid, data, *size < maxSize ? *size : maxSize, channel, P2P_CAPTURE_RECEIVED, *time);
+		return true;
+	}
+	bool Accept( CSteamID uid ) {
+		return inner->Accept(uid);
+	}
+	bool Close( CSteamID uid ) {
+		return inner->Close(uid);
+	}
+	bool GetState( CSteamID uid, P2PSessionState_t *state ) {
+		return inner->GetState(uid, state);
+	}
+	int GetPing( CSteamID uid ) {
+		return inner->GetPing(uid);
+	}
+};
+
+// Feeds the packets received in a capture back through the read path, at the recorded pace
+// multiplied by speed, or as fast as possible when speed is 0. Sent packets are discarded. Packets are timed
+// as recorded (relative to the start of the replay), so that the same capture always replays the same way.
+class ReplayBackend : public P2PBackend {
+	MappedFile file;
+	uint64 end;
+	double start;
+	double firstTime;
+	double speed;
+	std::mutex lock; // the network thread can read other channels
+	std::map<int, uint64> cursors;
+
+	p2p_capture_record *Next( int channel ) {
+		std::map<int, uint64>::iterator it = cursors.find(channel);
+		uint64 p = it == cursors.end() ? sizeof(p2p_capture_header) : it->second;
+		while( p + sizeof(p2p_capture_record) <= end ) {
+			p2p_capture_record *r = (p2p_capture_record*)(file.data + p);
+			if( r->size < sizeof(p2p_capture_record) || p + r->size > end )
+				break;
+			if( r->channel == channel && (r->flags & P2P_CAPTURE_RECEIVED) ) {
+				cursors[channel] = p;
+				if( speed > 0 && (p2p_time() - start) * speed < r->time - firstTime )
+					return NULL;
+				return r;
+			}
+			p += r->size;
+		}
+		cursors[channel] = end;
+		return NULL;
+	}
+	// the recorded time, rebased on the start of the replay and scaled by its speed
+	double ReplayTime( p2p_capture_record *r ) {
+		double t = r->time - firstTime;
+		return start + (speed > 0 ? t / speed : t);
+	}
+public:
+	std::atomic<int> remaining;
+
+	bool Open( const char *path, double speed ) {
+		if( !file.Open(path, 0, false) )
+			return false;
+		p2p_capture_header *h = (p2p_capture_header*)file.data;
+		if( file.size < sizeof(p2p_capture_header) || h->magic != P2P_CAPTURE_MAGIC || h->version != P2P_CAPTURE_VERSION ) {
+			file.Close(file.size);
+			return false;
+		}
+		end = h->length && h->length <= file.size ? h->length : file.size;
+		this->speed = speed;
+		cursors.clear();
+		firstTime = 0;
+		int count = 0;
+		for(uint64 p=sizeof(p2p_capture_header); p + sizeof(p2p_capture_record) <= end;) {
+			p2p_capture_record *r = (p2p_capture_record*)(file.data + p);
+			if( r->size < sizeof(p2p_capture_record) || p + r->size > end )
+				break;
+			if( r->flags & P2P_CAPTURE_RECEIVED ) {
+				if( count == 0 ) firstTime = r->time;
+				count++;
+			}
+			p += r->size;
+		}
+		remaining.store(count);
+		start = p2p_time();
+		return true;
+	}
+	void Close() {
+		file.Close(file.size);
+		remaining.store(0);
+	}
+	bool Send( CSteamID uid, const void *data, uint32 size, int type, int channel ) {
+		return true;
+	}
+	bool IsAvailable( uint32 *size, int channel ) {
+		std::lock_guard<std::mutex> l(lock);
+		p2p_capture_record *r = Next(channel);
+		if( r == NULL )
+			return false;
+		*size = r->length;
+		return true;
+	}
+	bool Read( void *data, uint32 maxSize, uint32 *size, CSteamID *uid, double *time, int channel ) {
+		std::lock_guard<std::mutex> l(lock);
+		p2p_capture_record *r = Next(channel);
+		if( r == NULL )
+			return false;
+		*size = r->length < maxSize ? r->length : maxSize;
+		memcpy(data, r + 1, *size);
+		*uid = CSteamID((uint64)r->uid);
+		*time = ReplayTime(r);
+		cursors[channel] += r->size;
+		remaining--;
+		return true;
+	}
+	bool Accept( CSteamID uid ) {
+		return true;
+	}
+	bool Close( CSteamID uid ) {
+		return true;
+	}
+	bool GetState( CSteamID uid, P2PSessionState_t *state ) {
+		memset(state, 0, sizeof(P2PSessionState_t));
+		state->m_bConnectionActive = 1;
+		return true;
+	}
+};
+
+static CaptureBackend *capture = NULL;
+static ReplayBackend *replay = NULL;
+
+//-----------------------------------------------------------------------------------------------------------
+// Statistics
+//-----------------------------------------------------------------------------------------------------------
+
+// Datagrams are counted per peer as they are sent to / read from the backend, on the main thread.
+// Channels 7 and above share the last channel slot. Histograms have one bucket for [0,1ms) then one per
+// power of two : [1,2ms), [2,4ms), ... up to the last one for 8s and more.
+#define P2P_STATS_CHANNELS	8
+#define P2P_STATS_BUCKETS	16
+
+typedef struct {
+	int packetsOut;
+	int packetsIn;
+	double bytesOut;
+	double bytesIn;
+} p2p_channel_stats;
+
+// layout written by read_p2p_stats, P2P_STATS_SIZE bytes per peer
+typedef struct {
+	uint64 uid;
+	int ping;
+	int reserved;
+	int sendQueueBytes;
+	int sendQueuePackets;
+	int sendQueueBytesMax;
+	int sendQueuePacketsMax;
+	p2p_channel_stats channels[P2P_STATS_CHANNELS];
+	int arrivals[P2P_STATS_BUCKETS];
+	int pings[P2P_STATS_BUCKETS];
+} p2p_peer_stats;
+
+#define P2P_STATS_SIZE	((int)sizeof(p2p_peer_stats))
+
+typedef struct {
+	p2p_peer_stats stats;
+	double lastArrival;
+} p2p_peer;
+
+static std::map<uint64, p2p_peer> peer_stats;
+static p2p_peer *last_peer = NULL;
+
+static p2p_peer *get_peer_stats( CSteamID uid ) {
+	uint64 id = uid.ConvertToUint64();
+	if( last_peer && last_peer->stats.uid == id )
+		return last_peer;
+	std::map<uint64, p2p_peer>::iterator it = peer_stats.find(id);
+	if( it == peer_stats.end() ) {
+		p2p_peer *p = &peer_stats[id];
+		memset(p, 0, sizeof(p2p_peer));
+		p->stats.uid = id;
+		p->stats.ping = -1;
+		p->lastArrival = -1;
+		return last_peer = p;
+	}
+	return last_peer = &it->second;
+}
+
+static p2p_channel_stats *get_channel_stats( p2p_peer *p, int channel ) {
+	return &p->stats.channels[channel < 0 ? 0 : channel >= P2P_STATS_CHANNELS ? P2P_STATS_CHANNELS - 1 : channel];
+}
+
+static int stats_bucket( double ms ) {
+	int b = 0;
+	while( ms >= 1. && b < P2P_STATS_BUCKETS - 1 ) {
+		ms *= 0.5;
+		b++;
+	}
+	return b;
+}
+
+static void count_sent( CSteamID uid, int channel, int size ) {
+	p2p_channel_stats *c = get_channel_stats(get_peer_stats(uid), channel);
+	c->packetsOut++;
+	c->bytesOut += size;
+}
+
+static void count_received( CSteamID uid, int channel, int size, double time ) {
+	p2p_peer *p = get_peer_stats(uid);
+	p2p_channel_stats *c = get_channel_stats(p, channel);
+	c->packetsIn++;
+	c->bytesIn += size;
+	if( p->lastArrival >= 0 && time >= p->lastArrival )
+		p->stats.arrivals[stats_bucket((time - p->lastArrival) * 1000.)]++;
+	p->lastArrival = time;
+}
+
+static bool backend_send( CSteamID uid, const void *data, uint32 size, int type, int channel ) {
+	if( !backend->Send(uid, data, size, type, channel) )
+		return false;
+	count_sent(uid, channel, size);
+	return true;
+}
 
 vdynamic *CallbackHandler::EncodeP2PSessionRequest( P2PSessionRequest_t *d ) {
 	HLValue v;
-	v.Set("uid", d->m_steamIDRemote);
+	v.Set(field_uid, d->m_steamIDRemote);
 	return v.value;
 }
 
 vdynamic *CallbackHandler::EncodeP2PSessionConnectionFail( P2PSessionConnectFail_t *d ) {
 	HLValue v;
-	v.Set("uid", d->m_steamIDRemote);
-	v.Set("error", d->m_eP2PSessionError);
+	v.Set(field_uid, d->m_steamIDRemote);
+	v.Set(field_error, d->m_eP2PSessionError);
 	return v.value;
 }
 
+void CallbackHandler::FillP2PSessionRequest( event_obj *o, P2PSessionRequest_t *d ) {
+	hl_write_uid(((session_request_obj*)o)->uid, d->m_steamIDRemote.ConvertToUint64());
+}
+
+void CallbackHandler::FillP2PSessionConnectionFail( event_obj *o, P2PSessionConnectFail_t *d ) {
+	session_failed_obj *e = (session_failed_obj*)o;
+	hl_write_uid(e->uid, d->m_steamIDRemote.ConvertToUint64());
+	e->error = d->m_eP2PSessionError;
+	e->reason = 0;
+}
+
+// Coalescing : messages sent on a coalesced channel are packed per peer into datagrams of up to
+// P2P_MTU bytes, each one prefixed by its varint length. Both ends must coalesce the channel.
+#define P2P_MTU			1200
+#define P2P_VARINT_MAX	5
+
+typedef struct {
+	CSteamID uid;
+	int type;
+	int channel;
+	int size;
+	vbyte data[P2P_MTU];
+} p2p_send_buffer;
+
+static unsigned int coalesced_channels = 0;
+static std::map<std::pair<uint64,int>, p2p_send_buffer> send_buffers;
+
+static bool is_coalesced( int channel ) {
+	return channel >= 0 && channel < 32 && (coalesced_channels & (1 << channel)) != 0;
+}
+
+static int write_varint( vbyte *out, uint32 v ) {
+	int n = 0;
+	while( v >= 0x80 ) {
+		out[n++] = (vbyte)(v | 0x80);
+		v >>= 7;
+	}
+	out[n++] = (vbyte)v;
+	return n;
+}
+
+static int read_varint( const vbyte *in, int size, uint32 *v ) {
+	uint32 r = 0;
+	for(int n=0;n<size && n<P2P_VARINT_MAX;n++) {
+		r |= (uint32)(in[n] & 0x7F) << (7 * n);
+		if( !(in[n] & 0x80) ) {
+			*v = r;
+			return n + 1;
+		}
+	}
+	return -1;
+}
+
+// Fragmentation : datagrams sent on a fragmented channel are split into fragments of up to P2P_MTU bytes,
+// each one prefixed by the 16 bits message sequence, the fragment index and the fragment count.
+// The receiver rebuilds them in a preallocated arena and drops the messages left incomplete after a timeout.
+#define P2P_FRAGMENT_HEADER		4
+#define P2P_FRAGMENT_PAYLOAD	(P2P_MTU - P2P_FRAGMENT_HEADER)
+#define P2P_FRAGMENT_MAX		255
+
+typedef struct {
+	uint64 uid;
+	int channel;
+	int seq; // -1 when free
+	int count;
+	int received;
+	int size;
+	double start;
+	unsigned int mask[(P2P_FRAGMENT_MAX + 31) >> 5];
+} p2p_fragment_slot;
+
+static unsigned int fragmented_channels = 0;
+static std::map<std::pair<uint64,int>, int> send_sequences;
+static struct {
+	vbyte *arena;
+	p2p_fragment_slot *slots;
+	int slotCount;
+	int slotFragments;
+	double timeout;
+} reassembly = { NULL, NULL, 16, (64 << 10) / P2P_FRAGMENT_PAYLOAD + 1, 1. };
+
+static bool is_fragmented( int channel ) {
+	return channel >= 0 && channel < 32 && (fragmented_channels & (1 << channel)) != 0;
+}
+
+static bool send_fragments( CSteamID uid, const vbyte *data, int length, int type, int channel ) {
+	int count = length == 0 ? 1 : (length + P2P_FRAGMENT_PAYLOAD - 1) / P2P_FRAGMENT_PAYLOAD;
+	if( count > P2P_FRAGMENT_MAX )
+		return false;
+	int seq = send_sequences[std::make_pair(uid.ConvertToUint64(), channel)]++ & 0xFFFF;
+	vbyte buf[P2P_MTU];
+	buf[0] = (vbyte)seq;
+	buf[1] = (vbyte)(seq >> 8);
+	buf[3] = (vbyte)count;
+	for(int i=0;i<count;i++) {
+		int n = i == count - 1 ? length - i * P2P_FRAGMENT_PAYLOAD : P2P_FRAGMENT_PAYLOAD;
+		buf[2] = (vbyte)i;
+		memcpy(buf + P2P_FRAGMENT_HEADER, data + i * P2P_FRAGMENT_PAYLOAD, n);
+		if( !backend_send(uid, buf, P2P_FRAGMENT_HEADER + n, type, channel) )
+			return false;
+	}
+	return true;
+}
+
+static bool send_datagram( CSteamID uid, const vbyte *data, int length, int type, int channel ) {
+	if( is_fragmented(channel) )
+		return send_fragments(uid, data, length, type, channel);
+	return backend_send(uid, data, length, type, channel);
+}
+
+static void free_reassembly() {
+	free(reassembly.arena);
+	free(reassembly.slots);
+	reassembly.arena = NULL;
+	reassembly.slots = NULL;
+}
+
+static void release_fragment_slot( int slot ) {
+	if( slot >= 0 )
+		reassembly.slots[slot].seq = -1;
+}
+
+static vbyte *fragment_slot_data( int slot ) {
+	return reassembly.arena + (size_t)slot * reassembly.slotFragments * P2P_FRAGMENT_PAYLOAD;
+}
+
+// Feeds a datagram received on a fragmented channel. Returns the payload of a single fragment message,
+// or the rebuilt message once its last fragment arrives, in which case slot must be released after use.
+static vbyte *defragment( CSteamID uid, int channel, vbyte *data, int size, double time, int *outSize, int *slot ) {
+	*slot = -1;
+	if( size < P2P_FRAGMENT_HEADER )
+		return NULL;
+	int seq = data[0] | (data[1] << 8);
+	int index = data[2];
+	int count = data[3];
+	int n = size - P2P_FRAGMENT_HEADER;
+	if( count == 1 ) {
+		*outSize = n;
+		return data + P2P_FRAGMENT_HEADER;
+	}
+	if( index >= count || n > P2P_FRAGMENT_PAYLOAD || (index < count - 1 && n != P2P_FRAGMENT_PAYLOAD) )
+		return NULL;
+	if( count > reassembly.slotFragments ) {
+		if( index == 0 )
+			printf("[HLSTEAM] P2P message of %d fragments dropped : larger than the reassembly slots\n", count);
+		return NULL;
+	}
+	if( !reassembly.arena ) {
+		reassembly.arena = (vbyte*)malloc((size_t)reassembly.slotCount * reassembly.slotFragments * P2P_FRAGMENT_PAYLOAD);
+		reassembly.slots = (p2p_fragment_slot*)malloc(reassembly.slotCount * sizeof(p2p_fragment_slot));
+		for(int i=0;i<reassembly.slotCount;i++)
+			reassembly.slots[i].seq = -1;
+	}
+	uint64 id = uid.ConvertToUint64();
+	int found = -1, empty = -1, oldest = -1;
+	for(int i=0;i<reassembly.slotCount;i++) {
+		p2p_fragment_slot *s = &reassembly.slots[i];
+		// incomplete for too long : drop it
+		if( s->seq >= 0 && time - s->start > reassembly.timeout )
+			s->seq = -1;
+		if( s->seq < 0 ) {
+			if( empty < 0 ) empty = i;
+			continue;
+		}
+		if( s->uid == id && s->channel == channel && s->seq == seq ) {
+			found = i;
+			break;
+		}
+		if( oldest < 0 || s->start < reassembly.slots[oldest].start )
+			oldest = i;
+	}
+	if( found < 0 ) {
+		// all slots busy : the oldest incomplete message is dropped
+		found = empty >= 0 ? empty : oldest;
+		p2p_fragment_slot *s = &reassembly.slots[found];
+		s->uid = id;
+		s->channel = channel;
+		s->seq = seq;
+		s->count = count;
+		s->received = 0;
+		s->size = 0;
+		s->start = time;
+		memset(s->mask, 0, sizeof(s->mask));
+	}
+	p2p_fragment_slot *s = &reassembly.slots[found];
+	if( s->count != count || (s->mask[index >> 5] & (1u << (index & 31))) )
+		return NULL;
+	s->mask[index >> 5] |= 1u << (index & 31);
+	memcpy(fragment_slot_data(found) + index * P2P_FRAGMENT_PAYLOAD, data + P2P_FRAGMENT_HEADER, n);
+	if( index == count - 1 )
+		s->size = index * P2P_FRAGMENT_PAYLOAD + n;
+	if( ++s->received < count )
+		return NULL;
+	*outSize = s->size;
+	*slot = found;
+	return fragment_slot_data(found);
+}
+
+static bool flush_send_buffer( p2p_send_buffer *b ) {
+	if( b->size == 0 )
+		return true;
+	bool ok = send_datagram(b->uid, b->data, b->size, b->type, b->channel);
+	b->size = 0;
+	return ok;
+}
+
+static bool queue_p2p_packet( CSteamID uid, vbyte *data, int length, int type, int channel ) {
+	p2p_send_buffer *b = &send_buffers[std::make_pair(uid.ConvertToUint64(), (channel << 2) | type)];
+	b->uid = uid;
+	b->type = type;
+	b->channel = channel;
+	// leave room for the fragment header so that a full datagram still fits in one fragment
+	int limit = is_fragmented(channel) ? P2P_FRAGMENT_PAYLOAD : P2P_MTU;
+	if( b->size + P2P_VARINT_MAX + length > limit && !flush_send_buffer(b) )
+		return false;
+	if( P2P_VARINT_MAX + length > limit ) {
+		// too big to be packed with others : send it alone, still framed
+		std::vector<vbyte> tmp(P2P_VARINT_MAX + length);
+		int n = write_varint(&tmp[0], length);
+		memcpy(&tmp[n], data, length);
+		return send_datagram(uid, &tmp[0], n + length, type, channel);
+	}
+	b->size += write_varint(b->data + b->size, length);
+	memcpy(b->data + b->size, data, length);
+	b->size += length;
+	return true;
+}
+
+HL_PRIM bool HL_NAME(flush_p2p_packets)() {
+	bool ok = true;
+	for(std::map<std::pair<uint64,int>, p2p_send_buffer>::iterator it = send_buffers.begin(); it != send_buffers.end(); ++it)
+		if( !flush_send_buffer(&it->second) )
+			ok = false;
+	return ok;
+}
+
+HL_PRIM bool HL_NAME(set_p2p_coalesce)( int channel, bool b ) {
+	if( channel < 0 || channel >= 32 )
+		return false;
+	if( b ) {
+		coalesced_channels |= 1 << channel;
+		return true;
+	}
+	bool ok = true;
+	for(std::map<std::pair<uint64,int>, p2p_send_buffer>::iterator it = send_buffers.begin(); it != send_buffers.end(); ++it)
+		if( it->second.channel == channel && !flush_send_buffer(&it->second) )
+			ok = false;
+	coalesced_channels &= ~(1 << channel);
+	return ok;
+}
+
+HL_PRIM bool HL_NAME(set_p2p_fragment)( int channel, bool b ) {
+	if( channel < 0 || channel >= 32 )
+		return false;
+	// pending coalesced messages are sent with the current framing
+	bool ok = true;
+	for(std::map<std::pair<uint64,int>, p2p_send_buffer>::iterator it = send_buffers.begin(); it != send_buffers.end(); ++it)
+		if( it->second.channel == channel && !flush_send_buffer(&it->second) )
+			ok = false;
+	if( b )
+		fragmented_channels |= 1 << channel;
+	else
+		fragmented_channels &= ~(1 << channel);
+	return ok;
+}
+
+// reallocates the reassembly arena, messages being rebuilt are dropped
+HL_PRIM bool HL_NAME(set_p2p_reassembly)( int maxMessageSize, int slots, double timeout ) {
+	int fragments = (maxMessageSize + P2P_FRAGMENT_PAYLOAD - 1) / P2P_FRAGMENT_PAYLOAD;
+	if( fragments <= 0 || fragments > P2P_FRAGMENT_MAX || slots <= 0 || timeout <= 0 )
+		return false;
+	free_reassembly();
+	reassembly.slotFragments = fragments;
+	reassembly.slotCount = slots;
+	reassembly.timeout = timeout;
+	return true;
+}
+
 HL_PRIM bool HL_NAME(send_p2p_packet)( vuid uid, vbyte *data, int length, int type, int channel ) {
-	return Networking()->SendP2PPacket(hl_to_uid(uid),data,length,(EP2PSend)type,channel);
+	if( is_coalesced(channel) )
+		return queue_p2p_packet(hl_to_uid(uid),data,length,type,channel);
+	return send_datagram(hl_to_uid(uid),data,length,type,channel);
 }
 
 HL_PRIM bool HL_NAME(accept_p2p_session)( vuid uid ) {
-	return Networking()->AcceptP2PSessionWithUser(hl_to_uid(uid));
+	return backend->Accept(hl_to_uid(uid));
 }
 
 HL_PRIM bool HL_NAME(is_p2p_packet_available)( uint32 *msgSize, int channel ) {
-	return Networking()->IsP2PPacketAvailable(msgSize,channel);
+	return backend->IsAvailable(msgSize,channel);
 }
 
 HL_PRIM vuid HL_NAME(read_p2p_packet)( vbyte *data, int maxLength, uint32 *length, int channel ) {
 	CSteamID uid;
-	if( !Networking()->ReadP2PPacket(data, maxLength, length, &uid, channel) )
+	double time;
+	if( !backend->Read(data, maxLength, length, &uid, &time, channel) )
 		return NULL;
 	return hl_of_uid(uid);
 }
 
+// same as read_p2p_packet, but returns the interned sender id (0 if there was no packet)
+HL_PRIM int HL_NAME(read_p2p_packet_id)( vbyte *data, int maxLength, uint32 *length, int channel ) {
+	CSteamID uid;
+	double time;
+	if( !backend->Read(data, maxLength, length, &uid, &time, channel) )
+		return 0;
+	return hl_intern_id(uid.ConvertToUint64());
+}
+
+// read_p2p_packets writes each packet as a packed header followed by its payload :
+// 8 bytes sender uid, 4 bytes channel, 4 bytes payload length, 8 bytes arrival time
+#define P2P_HEADER_SIZE 24
+
+static void write_p2p_header( vbyte *out, CSteamID uid, int channel, int length, double time ) {
+	uint64 id = uid.ConvertToUint64();
+	memcpy(out, &id, 8);
+	memcpy(out + 8, &channel, 4);
+	memcpy(out + 12, &length, 4);
+	memcpy(out + 16, &time, 8);
+}
+
+// Single producer / single consumer ring of packet records, filled by the network thread.
+// Each record is an int size followed by a packed header and its payload, aligned on 8 bytes.
+#define P2P_RECORD_SIZE(len)	((8 + (len) + 7) & ~7)
+
+class P2PQueue {
+	vbyte *data;
+	uint32 size;
+	uint32 reserved;
+	uint32 pad;
+	std::atomic<uint32> head;
+	std::atomic<uint32> tail;
+public:
+	P2PQueue( uint32 size ) : size(size), reserved(0), pad(0), head(0), tail(0) {
+		data = (vbyte*)malloc(size);
+	}
+	~P2PQueue() {
+		free(data);
+	}
+	uint32 Capacity() {
+		return size;
+	}
+	bool IsEmpty() {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_relaxed);
+	}
+	// producer : returns room for a record of up to len bytes, or NULL if the queue is full
+	vbyte *Reserve( int len ) {
+		uint32 h = head.load(std::memory_order_relaxed);
+		uint32 used = h - tail.load(std::memory_order_acquire);
+		uint32 offset = h & (size - 1);
+		uint32 need = P2P_RECORD_SIZE(len);
+		pad = offset + need > size ? size - offset : 0;
+		if( need + pad > size - used )
+			return NULL;
+		if( pad )
+			*(int*)(data + offset) = -1; // tells the consumer to wrap
+		reserved = (h + pad) & (size - 1);
+		return data + reserved + 8;
+	}
+	void Commit( int len ) {
+		*(int*)(data + reserved) = len;
+		head.store(head.load(std::memory_order_relaxed) + pad + P2P_RECORD_SIZE(len), std::memory_order_release);
+	}
+	// consumer
+	vbyte *Peek( int *len ) {
+		uint32 t = tail.load(std::memory_order_relaxed);
+		if( t == head.load(std::memory_order_acquire) )
+			return NULL;
+		uint32 offset = t & (size - 1);
+		if( *(int*)(data + offset) < 0 ) {
+			t += size - offset;
+			tail.store(t, std::memory_order_release);
+			offset = 0;
+		}
+		*len = *(int*)(data + offset);
+		return data + offset + 8;
+	}
+	void Pop( int len ) {
+		tail.store(tail.load(std::memory_order_relaxed) + P2P_RECORD_SIZE(len), std::memory_order_release);
+	}
+};
+
+static P2PQueue *recv_queues[32] = {};
+static unsigned int thread_channels = 0;
+static std::atomic<bool> thread_running(false);
+static std::thread *net_thread = NULL;
+// packets larger than their receive queue, read by the thread and discarded
+static std::atomic<int> thread_dropped(0);
+
+static void p2p_thread_loop( unsigned int channels, int sleepMicros ) {
+	std::vector<vbyte> scratch;
+	while( thread_running.load() ) {
+		bool idle = true;
+		for(int c=0;c<32;c++) {
+			if( !(channels & (1 << c)) )
+				continue;
+			uint32 size;
+			while( backend->IsAvailable(&size, c) ) {
+				CSteamID uid;
+				double time;
+				if( P2P_RECORD_SIZE(P2P_HEADER_SIZE + size) > recv_queues[c]->Capacity() ) {
+					if( scratch.size() <= size )
+						scratch.resize(size + 1);
+					if( !backend->Read(&scratch[0], size, &size, &uid, &time, c) )
+						break;
+					thread_dropped.fetch_add(1);
+					continue;
+				}
+				// when full, leave the packet in the Steam queue until the main thread catches up
+				vbyte *rec = recv_queues[c]->Reserve(P2P_HEADER_SIZE + size);
+				if( rec == NULL )
+					break;
+				if( !backend->Read(rec + P2P_HEADER_SIZE, size, &size, &uid, &time, c) )
+					break;
+				write_p2p_header(rec, uid, c, size, time);
+				recv_queues[c]->Commit(P2P_HEADER_SIZE + size);
+				idle = false;
+			}
+		}
+		if( idle )
+			std::this_thread::sleep_for(std::chrono::microseconds(sleepMicros));
+	}
+}
+
+// coalesced datagram (or rebuilt message) being split, kept across calls when the output buffer gets full
+static struct {
+	CSteamID uid;
+	int channel;
+	double time;
+	bool framed;
+	int pos;
+	int size;
+	std::vector<vbyte> data;
+} recv_split;
+
+static int split_p2p_datagram( vbyte *out, int pos, int maxLength, int *pending ) {
+	while( recv_split.pos < recv_split.size ) {
+		uint32 len = recv_split.size - recv_split.pos;
+		int n = recv_split.framed ? read_varint(&recv_split.data[recv_split.pos], recv_split.size - recv_split.pos, &len) : 0;
+		if( n < 0 || len > (uint32)(recv_split.size - recv_split.pos - n) ) {
+			// malformed : drop the rest of the datagram
+			recv_split.pos = recv_split.size;
+			break;
+		}
+		if( pos + P2P_HEADER_SIZE + (int)len > maxLength ) {
+			*pending = P2P_HEADER_SIZE + len;
+			break;
+		}
+		write_p2p_header(out + pos, recv_split.uid, recv_split.channel, len, recv_split.time);
+		memcpy(out + pos + P2P_HEADER_SIZE, &recv_split.data[recv_split.pos + n], len);
+		pos += P2P_HEADER_SIZE + len;
+		recv_split.pos += n + len;
+	}
+	return pos;
+}
+
+static vbyte *begin_split( CSteamID uid, int channel, uint32 size, double time ) {
+	if( recv_split.data.size() <= size )
+		recv_split.data.resize(size + 1);
+	recv_split.uid = uid;
+	recv_split.channel = channel;
+	recv_split.time = time;
+	recv_split.framed = is_coalesced(channel);
+	recv_split.size = size;
+	recv_split.pos = 0;
+	return &recv_split.data[0];
+}
+
+// the split buffer holds a fragment : replace it by its message, or by nothing while incomplete
+static void defragment_split() {
+	int size, slot;
+	vbyte *msg = defragment(recv_split.uid, recv_split.channel, &recv_split.data[0], recv_split.size, recv_split.time, &size, &slot);
+	if( msg == NULL ) {
+		recv_split.size = 0;
+		return;
+	}
+	if( slot < 0 ) {
+		recv_split.pos = P2P_FRAGMENT_HEADER;
+		return;
+	}
+	memcpy(begin_split(recv_split.uid, recv_split.channel, size, recv_split.time), msg, size);
+	release_fragment_slot(slot);
+}
+
+static void consume_budget( int *budget, int size ) {
+	// the packet that crosses the budget is still read so that a channel can never starve
+	if( *budget > 0 )
+		*budget = *budget > size ? *budget - size : 0;
+}
+
+static bool split_pending() {
+	return recv_split.pos < recv_split.size;
+}
+
+// only the part of the datagram that was split is charged, the rest is when it is resumed
+static int split_datagram_budget( vbyte *out, int pos, int maxLength, int *budget, int *pending ) {
+	int start = recv_split.pos;
+	pos = split_p2p_datagram(out, pos, maxLength, pending);
+	consume_budget(budget, recv_split.pos - start);
+	return pos;
+}
+
+// the rest of a datagram split by a previous read : only resumed when its channel is read, within its budget
+static int resume_split( vbyte *out, int pos, int maxLength, int channel, int *budget, int *pending ) {
+	if( !split_pending() || recv_split.channel != channel || *budget == 0 )
+		return pos;
+	return split_datagram_budget(out, pos, maxLength, budget, pending);
+}
+
+static int read_p2p_queue( P2PQueue *q, vbyte *out, int pos, int maxLength, int channel, int *budget, int *pending ) {
+	int len;
+	vbyte *rec;
+	while( *budget != 0 && (rec = q->Peek(&len)) != NULL ) {
+		int size = len - P2P_HEADER_SIZE;
+		uint64 uid;
+		double time;
+		memcpy(&uid, rec, 8);
+		memcpy(&time, rec + 16, 8);
+		count_received(CSteamID(uid), channel, size, time);
+		if( is_coalesced(channel) || is_fragmented(channel) ) {
+			// the split buffer still holds the rest of another channel datagram
+			if( split_pending() )
+				break;
+			memcpy(begin_split(CSteamID(uid), channel, size, time), rec + P2P_HEADER_SIZE, size);
+			q->Pop(len);
+			if( is_fragmented(channel) )
+				defragment_split();
+			pos = split_datagram_budget(out, pos, maxLength, budget, pending);
+		} else {
+			if( pos + len > maxLength ) {
+				*pending = len;
+				break;
+			}
+			memcpy(out + pos, rec, len);
+			q->Pop(len);
+			pos += len;
+			consume_budget(budget, size);
+		}
+		if( *pending )
+			break;
+	}
+	return pos;
+}
+
+static int read_p2p_channel( vbyte *out, int pos, int maxLength, int channel, int *budget, int *pending ) {
+	pos = resume_split(out, pos, maxLength, channel, budget, pending);
+	if( *pending )
+		return pos;
+	if( channel >= 0 && channel < 32 && recv_queues[channel] ) {
+		pos = read_p2p_queue(recv_queues[channel], out, pos, maxLength, channel, budget, pending);
+		// the network thread owns the Steam queue of this channel
+		if( *pending || (thread_channels & (1 << channel)) )
+			return pos;
+	}
+	uint32 size;
+	while( *budget != 0 && backend->IsAvailable(&size, channel) ) {
+		CSteamID uid;
+		double time;
+		if( is_coalesced(channel) || is_fragmented(channel) ) {
+			if( split_pending() )
+				break;
+			if( !backend->Read(begin_split(uid, channel, size, 0), size, &size, &recv_split.uid, &recv_split.time, channel) ) {
+				recv_split.size = 0;
+				break;
+			}
+			recv_split.size = size;
+			count_received(recv_split.uid, channel, size, recv_split.time);
+			if( is_fragmented(channel) )
+				defragment_split();
+			pos = split_datagram_budget(out, pos, maxLength, budget, pending);
+			if( *pending )
+				break;
+			continue;
+		}
+		if( pos + P2P_HEADER_SIZE + (int)size > maxLength ) {
+			// does not fit : keep it queued and tell the caller how much room it needs
+			*pending = P2P_HEADER_SIZE + size;
+			break;
+		}
+		if( !backend->Read(out + pos + P2P_HEADER_SIZE, size, &size, &uid, &time, channel) )
+			break;
+		count_received(uid, channel, size, time);
+		write_p2p_header(out + pos, uid, channel, size, time);
+		pos += P2P_HEADER_SIZE + size;
+		consume_budget(budget, size);
+	}
+	return pos;
+}
+
+HL_PRIM int HL_NAME(read_p2p_packets)( vbyte *out, int maxLength, int channel, int *pending ) {
+	int budget = -1;
+	*pending = 0;
+	return read_p2p_channel(out, 0, maxLength, channel, &budget, pending);
+}
+
+// channels is a table of (channel, remaining byte budget) pairs, drained in order.
+// Budgets are decremented in place, -1 means unlimited.
+HL_PRIM int HL_NAME(read_p2p_channels)( vbyte *out, int maxLength, int *channels, int count, int *pending ) {
+	*pending = 0;
+	int pos = 0;
+	if( split_pending() ) {
+		// the rest of a datagram of a channel no longer read is dropped
+		bool found = false;
+		for(int i=0;i<count;i++)
+			if( channels[i<<1] == recv_split.channel ) found = true;
+		if( !found ) recv_split.pos = recv_split.size;
+	}
+	for(int i=0;i<count && *pending == 0;i++)
+		pos = read_p2p_channel(out, pos, maxLength, channels[i<<1], &channels[(i<<1)+1], pending);
+	return pos;
+}
+
+static void call_packet_handler( vclosure *c, vbyte *header, vbyte *data ) {
+	if( c->hasValue )
+		((void(*)(void*, vbyte*, vbyte*))c->fun)(c->value, header, data);
+	else
+		((void(*)(vbyte*, vbyte*))c->fun)(header, data);
+}
+
+// Messages backend only : hands each message to onMessage(header, data) without copying it, and releases
+// it once the handler returns. channels is the same (channel, budget) table as read_p2p_channels.
+HL_PRIM int HL_NAME(receive_p2p_messages)( int *channels, int count, vclosure *onMessage ) {
+#ifdef STEAM_NETWORKING_MESSAGES
+	if( backend_id != SteamMessages || replay )
+		return -1;
+	vbyte header[P2P_HEADER_SIZE];
+	int total = 0;
+	for(int i=0;i<count;i++) {
+		int channel = channels[i<<1];
+		int *budget = &channels[(i<<1)+1];
+		SteamNetworkingMessage_t *m;
+		while( *budget != 0 && (m = messages_backend.Take(channel)) != NULL ) {
+			CSteamID uid = m->m_identityPeer.GetSteamID();
+			double time = messages_backend.Time(m);
+			vbyte *data = (vbyte*)m->m_pData;
+			int size = m->m_cbSize;
+			int slot = -1;
+			if( capture )
+				capture->Record(uid, data, size, channel, P2P_CAPTURE_RECEIVED, time);
+			count_received(uid, channel, size, time);
+			consume_budget(budget, size);
+			if( is_fragmented(channel) && (data = defragment(uid, channel, data, size, time, &size, &slot)) == NULL ) {
+				m->Release();
+				continue;
+			}
+			if( is_coalesced(channel) ) {
+				int pos = 0;
+				while( pos < size ) {
+					uint32 len;
+					int n = read_varint(data + pos, size - pos, &len);
+					if( n < 0 || len > (uint32)(size - pos - n) )
+						break;
+					write_p2p_header(header, uid, channel, len, time);
+					call_packet_handler(onMessage, header, data + pos + n);
+					pos += n + len;
+					total++;
+				}
+			} else {
+				write_p2p_header(header, uid, channel, size, time);
+				call_packet_handler(onMessage, header, data);
+				total++;
+			}
+			m->Release();
+			release_fragment_slot(slot);
+		}
+	}
+	return total;
+#else
+	return -1;
+#endif
+}
+
+HL_PRIM int HL_NAME(get_p2p_thread_dropped)() {
+	return thread_dropped.load();
+}
+
+HL_PRIM void HL_NAME(stop_p2p_thread)() {
+	if( !net_thread ) return;
+	thread_running.store(false);
+	net_thread->join();
+	delete net_thread;
+	net_thread = NULL;
+	thread_channels = 0;
+	// packets already queued are still read by read_p2p_channels
+}
+
+// polls the channels set in the mask from a native thread, each into its own queue of queueSize bytes
+HL_PRIM bool HL_NAME(start_p2p_thread)( int channels, int queueSize, int sleepMicros ) {
+	HL_NAME(stop_p2p_thread)();
+	uint32 size = 1024;
+	while( size < (uint32)queueSize )
+		size <<= 1;
+	for(int c=0;c<32;c++) {
+		if( !(channels & (1 << c)) )
+			continue;
+		if( recv_queues[c] && recv_queues[c]->Capacity() != size && recv_queues[c]->IsEmpty() ) {
+			delete recv_queues[c];
+			recv_queues[c] = NULL;
+		}
+		if( !recv_queues[c] )
+			recv_queues[c] = new P2PQueue(size);
+	}
+	thread_channels = (unsigned int)channels;
+	thread_running.store(true);
+	net_thread = new std::thread(p2p_thread_loop, thread_channels, sleepMicros);
+	return true;
+}
+
+HL_PRIM bool HL_NAME(set_p2p_backend)( int id ) {
+	if( net_thread || capture || replay )
+		return false;
+	HL_NAME(flush_p2p_packets)();
+	switch( id ) {
+	case SteamP2P:
+		backend = &steam_p2p_backend;
+		break;
+#ifdef STEAM_NETWORKING_MESSAGES
+	case SteamMessages:
+		if( !NetworkingMessages() )
+			return false;
+		if( SteamNetworkingUtils() )
+			SteamNetworkingUtils()->InitRelayNetworkAccess();
+		backend = &messages_backend;
+		break;
+#endif
+	case Loopback:
+		backend = &loopback_backend;
+		break;
+	default:
+		return false;
+	}
+	backend_id = (p2p_backend_id)id;
+	return true;
+}
+
+// records every packet sent and received in a file of up to maxSize bytes, while the receive thread is stopped
+HL_PRIM bool HL_NAME(start_p2p_capture)( vbyte *path, double maxSize ) {
+	if( net_thread || capture || replay )
+		return false;
+	CaptureBackend *c = new CaptureBackend();
+	if( !c->Open((char*)path, (uint64)maxSize) ) {
+		delete c;
+		return false;
+	}
+	HL_NAME(flush_p2p_packets)();
+	c->inner = backend;
+	backend = capture = c;
+	return true;
+}
+
+// returns the number of packets that did not fit in the capture file, or -1 if not capturing
+HL_PRIM int HL_NAME(stop_p2p_capture)() {
+	if( !capture || net_thread )
+		return -1;
+	HL_NAME(flush_p2p_packets)();
+	backend = capture->inner;
+	capture->Close();
+	int dropped = capture->dropped.load();
+	delete capture;
+	capture = NULL;
+	return dropped;
+}
+
+HL_PRIM bool HL_NAME(start_p2p_replay)( vbyte *path, double speed ) {
+	if( net_thread || capture || replay )
+		return false;
+	ReplayBackend *r = new ReplayBackend();
+	if( !r->Open((char*)path, speed) ) {
+		delete r;
+		return false;
+	}
+	HL_NAME(flush_p2p_packets)();
+	replay = r;
+	backend = replay;
+	return true;
+}
+
+HL_PRIM void HL_NAME(stop_p2p_replay)() {
+	if( !replay || net_thread )
+		return;
+	switch( backend_id ) {
+#ifdef STEAM_NETWORKING_MESSAGES
+	case SteamMessages:
+		backend = &messages_backend;
+		break;
+#endif
+	case Loopback:
+		backend = &loopback_backend;
+		break;
+	default:
+		backend = &steam_p2p_backend;
+		break;
+	}
+	replay->Close();
+	delete replay;
+	replay = NULL;
+}
+
+// received packets of the replay not read yet
+HL_PRIM int HL_NAME(get_p2p_replay_remaining)() {
+	return replay ? replay->remaining.load() : 0;
+}
+
+// Samples the session of every peer, then writes the stats of up to maxPeers peers to out,
+// P2P_STATS_SIZE bytes each. Returns the number of peers, which can be more than maxPeers.
+HL_PRIM int HL_NAME(read_p2p_stats)( vbyte *out, int maxPeers ) {
+	int count = 0;
+	for(std::map<uint64, p2p_peer>::iterator it = peer_stats.begin(); it != peer_stats.end(); ++it, count++) {
+		p2p_peer_stats *s = &it->second.stats;
+		CSteamID uid(it->first);
+		P2PSessionState_t state;
+		if( backend->GetState(uid, &state) ) {
+			s->sendQueueBytes = state.m_nBytesQueuedForSend;
+			s->sendQueuePackets = state.m_nPacketsQueuedForSend;
+			if( s->sendQueueBytes > s->sendQueueBytesMax ) s->sendQueueBytesMax = s->sendQueueBytes;
+			if( s->sendQueuePackets > s->sendQueuePacketsMax ) s->sendQueuePacketsMax = s->sendQueuePackets;
+		}
+		s->ping = backend->GetPing(uid);
+		if( s->ping >= 0 )
+			s->pings[stats_bucket(s->ping)]++;
+		if( count < maxPeers )
+			memcpy(out + count * P2P_STATS_SIZE, s, P2P_STATS_SIZE);
+	}
+	return count;
+}
+
+HL_PRIM void HL_NAME(reset_p2p_stats)() {
+	peer_stats.clear();
+	last_peer = NULL;
+}
+
+HL_PRIM double HL_NAME(get_p2p_time)() {
+	return p2p_time();
+}
+
 HL_PRIM vdynamic *HL_NAME(get_p2p_session_data)( vuid uid ) {
 	P2PSessionState_t state;
-	if( !Networking()->GetP2PSessionState(hl_to_uid(uid),&state) )
+	if( !backend->GetState(hl_to_uid(uid),&state) )
 		return NULL;
 	HLValue v;
 	v.Set("connecting",state.m_bConnecting != 0);
@@ -51,12 +1521,45 @@ HL_PRIM vdynamic *HL_NAME(get_p2p_session_data)( vuid uid ) {
 }
 
 HL_PRIM bool HL_NAME(close_p2p_session)( vuid uid ) {
-	return Networking()->CloseP2PSessionWithUser(hl_to_uid(uid));
+	CSteamID id = hl_to_uid(uid);
+	std::map<std::pair<uint64,int>, p2p_send_buffer>::iterator it = send_buffers.lower_bound(std::make_pair(id.ConvertToUint64(), 0));
+	while( it != send_buffers.end() && it->first.first == id.ConvertToUint64() )
+		send_buffers.erase(it++);
+	std::map<std::pair<uint64,int>, int>::iterator seq = send_sequences.lower_bound(std::make_pair(id.ConvertToUint64(), 0));
+	while( seq != send_sequences.end() && seq->first.first == id.ConvertToUint64() )
+		send_sequences.erase(seq++);
+	peer_stats.erase(id.ConvertToUint64());
+	last_peer = NULL;
+	if( reassembly.slots )
+		for(int i=0;i<reassembly.slotCount;i++)
+			if( reassembly.slots[i].uid == id.ConvertToUint64() )
+				reassembly.slots[i].seq = -1;
+	return backend->Close(id);
 }
 
 DEFINE_PRIM(_BOOL, send_p2p_packet, _UID _BYTES _I32 _I32 _I32);
+DEFINE_PRIM(_BOOL, flush_p2p_packets, _NO_ARG);
+DEFINE_PRIM(_BOOL, set_p2p_coalesce, _I32 _BOOL);
+DEFINE_PRIM(_BOOL, set_p2p_fragment, _I32 _BOOL);
+DEFINE_PRIM(_BOOL, set_p2p_reassembly, _I32 _I32 _F64);
 DEFINE_PRIM(_BOOL, accept_p2p_session, _UID);
 DEFINE_PRIM(_BOOL, is_p2p_packet_available, _REF(_I32) _I32);
 DEFINE_PRIM(_UID, read_p2p_packet, _BYTES _I32 _REF(_I32) _I32);
+DEFINE_PRIM(_ID, read_p2p_packet_id, _BYTES _I32 _REF(_I32) _I32);
+DEFINE_PRIM(_I32, read_p2p_packets, _BYTES _I32 _I32 _REF(_I32));
+DEFINE_PRIM(_I32, read_p2p_channels, _BYTES _I32 _BYTES _I32 _REF(_I32));
+DEFINE_PRIM(_I32, receive_p2p_messages, _BYTES _I32 _FUN(_VOID, _BYTES _BYTES));
+DEFINE_PRIM(_BOOL, set_p2p_backend, _I32);
+DEFINE_PRIM(_BOOL, start_p2p_capture, _BYTES _F64);
+DEFINE_PRIM(_I32, stop_p2p_capture, _NO_ARG);
+DEFINE_PRIM(_BOOL, start_p2p_replay, _BYTES _F64);
+DEFINE_PRIM(_VOID, stop_p2p_replay, _NO_ARG);
+DEFINE_PRIM(_I32, get_p2p_replay_remaining, _NO_ARG);
+DEFINE_PRIM(_BOOL, start_p2p_thread, _I32 _I32 _I32);
+DEFINE_PRIM(_VOID, stop_p2p_thread, _NO_ARG);
+DEFINE_PRIM(_I32, get_p2p_thread_dropped, _NO_ARG);
+DEFINE_PRIM(_I32, read_p2p_stats, _BYTES _I32);
+DEFINE_PRIM(_VOID, reset_p2p_stats, _NO_ARG);
+DEFINE_PRIM(_F64, get_p2p_time, _NO_ARG);
 DEFINE_PRIM(_DYN, get_p2p_session_data, _UID);
 DEFINE_PRIM(_BOOL, close_p2p_session, _UID);
@@ -0,0 +1,101 @@
+#include "steamwrap.h"
+#include <chrono>
+
+// Callback profiling : per callback id, the number of deliveries, the time spent encoding the event
+// and in the Haxe handler, and for call results the latency between the call and its result.
+// Histogram bucket 0 counts the durations under 1us, and bucket i the ones between 2^(i-1) and 2^i us.
+#define PROFILE_BUCKETS		24
+#define PROFILE_SERVER		0x40000000
+
+// layout written by read_callback_stats, PROFILE_STATS_SIZE bytes per callback
+typedef struct {
+	int id;
+	int server;
+	int count;
+	int results;
+	double encodeTime;
+	double handlerTime;
+	double latency;
+	int encode[PROFILE_BUCKETS];
+	int handler[PROFILE_BUCKETS];
+	int latencies[PROFILE_BUCKETS];
+} callback_stats;
+
+#define PROFILE_STATS_SIZE	((int)sizeof(callback_stats))
+
+bool s_profiling = false;
+static std::map<int, callback_stats> stats;
+
+int64 profile_now() {
+	return (int64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int profile_bucket( int64 ns ) {
+	int64 us = ns / 1000;
+	int b = 0;
+	while( us > 0 && b < PROFILE_BUCKETS - 1 ) {
+		us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static callback_stats *get_callback_stats( int id, bool server ) {
+	int key = server ? id | PROFILE_SERVER : id;
+	std::map<int, callback_stats>::iterator it = stats.find(key);
+	if( it != stats.end() )
+		return &it->second;
+	callback_stats *s = &stats[key];
+	memset(s, 0, sizeof(callback_stats));
+	s->id = id;
+	s->server = server;
+	return s;
+}
+
+// start is 0 if profiling was disabled when the callback started
+void profile_callback( int id, bool server, int64 start, int64 encoded ) {
+	if( !start || !s_profiling ) return;
+	int64 now = profile_now();
+	callback_stats *s = get_callback_stats(id, server);
+	s->count++;
+	s->encodeTime += (encoded - start) * 1e-9;
+	s->handlerTime += (now - encoded) * 1e-9;
+	s->encode[profile_bucket(encoded - start)]++;
+	s->handler[profile_bucket(now - encoded)]++;
+}
+
+void profile_call_result( int id, int64 issued, int64 start ) {
+	if( !start || !s_profiling ) return;
+	int64 now = profile_now();
+	callback_stats *s = get_callback_stats(id, false);
+	s->count++;
+	s->handlerTime += (now - start) * 1e-9;
+	s->handler[profile_bucket(now - start)]++;
+	if( issued ) {
+		s->results++;
+		s->latency += (start - issued) * 1e-9;
+		s->latencies[profile_bucket(start - issued)]++;
+	}
+}
+
+HL_PRIM void HL_NAME(set_profiling)( bool b ) {
+	s_profiling = b;
+}
+
+// writes the stats of up to maxCallbacks callbacks to out, PROFILE_STATS_SIZE bytes each,
+// returns the number of callbacks, which can be more than maxCallbacks
+HL_PRIM int HL_NAME(read_callback_stats)( vbyte *out, int maxCallbacks ) {
+	int count = 0;
+	for(std::map<int, callback_stats>::iterator it = stats.begin(); it != stats.end(); ++it, count++)
+		if( count < maxCallbacks )
+			memcpy(out + count * PROFILE_STATS_SIZE, &it->second, PROFILE_STATS_SIZE);
+	return count;
+}
+
+HL_PRIM void HL_NAME(reset_callback_stats)() {
+	stats.clear();
+}
+
+DEFINE_PRIM(_VOID, set_profiling, _BOOL);
+DEFINE_PRIM(_I32, read_callback_stats, _BYTES _I32);
+DEFINE_PRIM(_VOID, reset_callback_stats, _NO_ARG);
@@ -9,5 +9,9 @@ EVENT_DECL(ValidateAuthTicketResponse, ValidateAuthTicketResponse_t )
 
 EVENT_DECL(P2PSessionRequest, P2PSessionRequest_t )
 EVENT_DECL(P2PSessionConnectFail, P2PSessionConnectFail_t )
+#ifdef STEAM_NETWORKING_MESSAGES
+EVENT_DECL(MessagesSessionRequest, SteamNetworkingMessagesSessionRequest_t )
+EVENT_DECL(MessagesSessionFailed, SteamNetworkingMessagesSessionFailed_t )
+#endif
 
 #undef EVENT_DECL
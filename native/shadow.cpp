@@ -0,0 +1,224 @@
+#include "steamwrap.h"
+#ifdef HL_WIN
+#	include <windows.h>
+#	include <io.h>
+#else
+#	include <unistd.h>
+#endif
+
+// Stats shadow : every stat and achievement written is also kept in memory and journaled to a file, so that
+// reads are local and the progress made while Steam is unavailable survives until it can be stored (see stats.cpp).
+// The journal is a header followed by checksummed records, appended as values change : a record torn by a crash
+// is ignored when loading. It is rewritten compacted when opened, and when it grows too much.
+#define SHADOW_MAGIC		0x53534C48 // HLSS
+#define SHADOW_VERSION		1
+#define SHADOW_RECORD_MAX	(12 + 0xFFFF + 4)
+
+static std::map<std::string, shadow_value> s_values;
+static std::string s_path;
+static FILE *s_journal = NULL;
+static bool s_journalDirty = false;
+static int s_journalRecords = 0;
+static int s_unsynced = 0;
+
+static uint32 shadow_checksum( const vbyte *data, int size ) {
+	uint32 h = 2166136261u;
+	for(int i=0;i<size;i++) {
+		h ^= data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// 2 bytes name length, kind, synced, 8 bytes value, name, 4 bytes checksum
+static int shadow_encode( vbyte *out, const std::string &name, const shadow_value &v ) {
+	int len = (int)name.size();
+	out[0] = (vbyte)len;
+	out[1] = (vbyte)(len >> 8);
+	out[2] = (vbyte)v.kind;
+	out[3] = v.synced ? 1 : 0;
+	memcpy(out + 4, &v.value, 8);
+	memcpy(out + 12, name.c_str(), len);
+	uint32 sum = shadow_checksum(out, 12 + len);
+	memcpy(out + 12 + len, &sum, 4);
+	return 16 + len;
+}
+
+static bool shadow_write( FILE *f, const std::string &name, const shadow_value &v ) {
+	vbyte buf[SHADOW_RECORD_MAX];
+	if( name.size() > 0xFFFF ) return false;
+	int size = shadow_encode(buf, name, v);
+	return fwrite(buf, 1, size, f) == (size_t)size;
+}
+
+static void shadow_apply( const std::string &name, const shadow_value &v ) {
+	std::map<std::string, shadow_value>::iterator it = s_values.find(name);
+	if( it != s_values.end() && !it->second.synced ) s_unsynced--;
+	if( !v.synced ) s_unsynced++;
+	s_values[name] = v;
+}
+
+// complete is set if the journal ends with a whole record, so that more can be appended to it
+static bool shadow_load( const char *path, bool *complete ) {
+	*complete = false;
+	FILE *f = fopen(path, "rb");
+	if( !f ) return false;
+	int header[2];
+	if( fread(header, 1, 8, f) != 8 || header[0] != SHADOW_MAGIC || header[1] != SHADOW_VERSION ) {
+		fclose(f);
+		return false;
+	}
+	vbyte buf[SHADOW_RECORD_MAX];
+	size_t n;
+	while( (n = fread(buf, 1, 12, f)) == 12 ) {
+		int len = buf[0] | (buf[1] << 8);
+		if( fread(buf + 12, 1, len + 4, f) != (size_t)(len + 4) )
+			break;
+		uint32 sum;
+		memcpy(&sum, buf + 12 + len, 4);
+		if( sum != shadow_checksum(buf, 12 + len) )
+			break;
+		shadow_value v;
+		v.kind = buf[2];
+		v.synced = buf[3] != 0;
+		memcpy(&v.value, buf + 4, 8);
+		shadow_apply(std::string((char*)buf + 12, len), v);
+	}
+	*complete = n == 0 && feof(f);
+	fclose(f);
+	return true;
+}
+
+// written to the disk, not only handed to the OS
+static bool shadow_sync( FILE *f ) {
+	if( fflush(f) != 0 ) return false;
+#ifdef HL_WIN
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+// atomic : the target is either the previous file or the new one, even after a crash
+static bool shadow_replace( const char *from, const char *to ) {
+#ifdef HL_WIN
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+// the compacted journal is written aside, synced, and then replaces the current one, which is kept on failure
+static bool shadow_compact() {
+	std::string tmp = s_path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if( !f ) return false;
+	int header[2] = { SHADOW_MAGIC, SHADOW_VERSION };
+	bool ok = fwrite(header, 1, 8, f) == 8;
+	for(std::map<std::string, shadow_value>::iterator it = s_values.begin(); ok && it != s_values.end(); ++it)
+		ok = shadow_write(f, it->first, it->second);
+	ok = shadow_sync(f) && ok;
+	ok = fclose(f) == 0 && ok;
+	if( !ok ) {
+		remove(tmp.c_str());
+		return false;
+	}
+	// the journal can't be replaced while it is open on Windows
+	if( s_journal ) fclose(s_journal);
+	ok = shadow_replace(tmp.c_str(), s_path.c_str());
+	if( !ok ) remove(tmp.c_str());
+	s_journal = fopen(s_path.c_str(), "ab");
+	if( ok ) {
+		s_journalRecords = (int)s_values.size();
+		s_journalDirty = false;
+	}
+	return ok && s_journal != NULL;
+}
+
+bool shadow_enabled() {
+	return s_journal != NULL;
+}
+
+std::map<std::string, shadow_value> &shadow_values() {
+	return s_values;
+}
+
+bool shadow_get( const char *name, double *value ) {
+	if( !s_journal ) return false;
+	std::map<std::string, shadow_value>::iterator it = s_values.find(name);
+	if( it == s_values.end() ) return false;
+	*value = it->second.value;
+	return true;
+}
+
+void shadow_set( const char *name, int kind, double value, bool synced ) {
+	if( !s_journal ) return;
+	std::string key(name);
+	std::map<std::string, shadow_value>::iterator it = s_values.find(key);
+	if( it != s_values.end() && it->second.value == value && it->second.synced == synced && it->second.kind == kind )
+		return;
+	shadow_value v;
+	v.kind = kind;
+	v.value = value;
+	v.synced = synced;
+	shadow_apply(key, v);
+	if( shadow_write(s_journal, key, v) ) {
+		s_journalRecords++;
+		s_journalDirty = true;
+	}
+}
+
+void shadow_synced( const char *name ) {
+	if( !s_journal ) return;
+	std::map<std::string, shadow_value>::iterator it = s_values.find(name);
+	if( it != s_values.end() && !it->second.synced )
+		shadow_set(name, it->second.kind, it->second.value, true);
+}
+
+int shadow_unsynced() {
+	return s_journal ? s_unsynced : 0;
+}
+
+// called every frame with the stats update : the records are handed to the OS once per frame
+void shadow_flush() {
+	if( !s_journal || !s_journalDirty ) return;
+	if( s_journalRecords > 1024 && s_journalRecords > (int)s_values.size() * 4 && shadow_compact() )
+		return;
+	fflush(s_journal);
+	s_journalDirty = false;
+}
+
+HL_PRIM void HL_NAME(close_stats_shadow)();
+
+HL_PRIM bool HL_NAME(open_stats_shadow)( vbyte *path ) {
+	if( s_journal ) return false;
+	s_path = (char*)path;
+	s_values.clear();
+	s_unsynced = 0;
+	// no journal yet : the first compaction might have been interrupted after writing its records aside
+	bool complete, ignore;
+	if( !shadow_load(s_path.c_str(), &complete) )
+		shadow_load((s_path + ".tmp").c_str(), &ignore);
+	// if it can't be compacted, a complete journal is still appended to
+	if( !shadow_compact() && !(complete && s_journal) ) {
+		HL_NAME(close_stats_shadow)();
+		return false;
+	}
+	return true;
+}
+
+HL_PRIM void HL_NAME(close_stats_shadow)() {
+	if( !s_journal ) return;
+	fclose(s_journal);
+	s_journal = NULL;
+	s_values.clear();
+	s_unsynced = 0;
+}
+
+HL_PRIM int HL_NAME(get_unsynced_stats)() {
+	return shadow_unsynced();
+}
+
+DEFINE_PRIM(_BOOL, open_stats_shadow, _BYTES);
+DEFINE_PRIM(_VOID, close_stats_shadow, _NO_ARG);
+DEFINE_PRIM(_I32, get_unsynced_stats, _NO_ARG);
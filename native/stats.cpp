@@ -1,118 +1,174 @@
 #include "steamwrap.h"
-
-void CallbackHandler::OnUserStatsReceived( UserStatsReceived_t *pCallback ){
- 	if (pCallback->m_nGameID != SteamUtils()->GetAppID()) return;
-	SendEvent(UserStatsReceived, pCallback->m_eResult == k_EResultOK, NULL);
-}
-
-void CallbackHandler::OnUserStatsStored( UserStatsStored_t *pCallback ){
- 	if (pCallback->m_nGameID != SteamUtils()->GetAppID()) return;
-	SendEvent(UserStatsStored, pCallback->m_eResult == k_EResultOK, NULL);
+#include <set>
+#include <math.h>
+
+// Stats write coalescing : setting a stat or an achievement only marks it dirty, and a single StoreStats
+// sends all the changes, at most once every s_storeInterval. Achievements are stored without having to ask,
+// stats with store_stats. The changes of a store that failed are marked dirty again and retried.
+// When the stats shadow is opened (see shadow.cpp), the stats can be read and written while Steam is unavailable.
+#define STATS_STORE_TIMEOUT	10.
+
+static std::set<std::string> s_dirtyStats, s_dirtyAchievements;
+static std::set<std::string> s_storingStats, s_storingAchievements;
+static bool s_storeWanted = false;
+static bool s_storing = false;
+static double s_storeInterval = 1.;
+static int64 s_lastStore = 0;
+static bool s_statsReceived = false;
+static int64 s_lastStatsRequest = 0;
+
+static void stat_changed( const char *name );
+static void reset_stat_schema();
+static void reset_global_stats();
+
+static void merge_names( std::set<std::string> &to, std::set<std::string> &from ) {
+	to.insert(from.begin(), from.end());
+	from.clear();
 }
 
-void CallbackHandler::OnAchievementStored( UserAchievementStored_t *pCallback ){
- 	if (pCallback->m_nGameID != SteamUtils()->GetAppID()) return;
-	SendEvent(UserAchievementStored, true, pCallback->m_rgchAchievementName);
-}
-
-void CallbackHandler::FindLeaderboard(const char* name){
-	m_leaderboards[name] = 0;
- 	SteamAPICall_t hSteamAPICall = SteamUserStats()->FindLeaderboard(name);
- 	m_callResultFindLeaderboard.Set(hSteamAPICall, this, &CallbackHandler::OnLeaderboardFound);
+static void store_done( bool retry ) {
+	s_storing = false;
+	if( retry ) {
+		merge_names(s_dirtyStats, s_storingStats);
+		merge_names(s_dirtyAchievements, s_storingAchievements);
+		s_storeWanted = true;
+	} else {
+		// what was stored is synced in the shadow, unless it changed again meanwhile
+		for(std::set<std::string>::iterator it = s_storingStats.begin(); it != s_storingStats.end(); ++it)
+			if( !s_dirtyStats.count(*it) ) shadow_synced(it->c_str());
+		for(std::set<std::string>::iterator it = s_storingAchievements.begin(); it != s_storingAchievements.end(); ++it)
+			if( !s_dirtyAchievements.count(*it) ) shadow_synced(it->c_str());
+		s_storingStats.clear();
+		s_storingAchievements.clear();
+	}
 }
 
-void CallbackHandler::OnLeaderboardFound(LeaderboardFindResult_t *pCallback, bool bIOFailure)
-{
-	// see if we encountered an error during the call
-	if (pCallback->m_bLeaderboardFound && !bIOFailure)	{
-		std::string leaderboardId = SteamUserStats()->GetLeaderboardName(pCallback->m_hSteamLeaderboard);
-		m_leaderboards[leaderboardId] = pCallback->m_hSteamLeaderboard;
-		SendEvent(LeaderboardFound, true, leaderboardId.c_str());
-	}else{
-		SendEvent(LeaderboardFound, false, NULL);
+static bool steam_get_value( const char *name, int kind, double *value ) {
+	bool ok;
+	if( kind == SHADOW_INT ) {
+		int32 v = 0;
+		ok = SteamUserStats()->GetStat(name, &v);
+		*value = v;
+	} else if( kind == SHADOW_FLOAT ) {
+		float v = 0;
+		ok = SteamUserStats()->GetStat(name, &v);
+		*value = v;
+	} else {
+		bool v = false;
+		ok = SteamUserStats()->GetAchievement(name, &v);
+		*value = v ? 1 : 0;
 	}
+	return ok;
 }
 
-bool CallbackHandler::UploadScore(const std::string& leaderboardId, int score, int detail){
-   	if (m_leaderboards.find(leaderboardId) == m_leaderboards.end() || m_leaderboards[leaderboardId] == 0)
-   		return false;
-
-	SteamAPICall_t hSteamAPICall = SteamUserStats()->UploadLeaderboardScore(m_leaderboards[leaderboardId], k_ELeaderboardUploadScoreMethodKeepBest, score, &detail, 1);
-	m_callResultUploadScore.Set(hSteamAPICall, this, &CallbackHandler::OnScoreUploaded);
- 	return true;
+static bool steam_set_value( const char *name, int kind, double value ) {
+	bool ok;
+	if( kind == SHADOW_INT )
+		ok = SteamUserStats()->SetStat(name, (int32)value);
+	else if( kind == SHADOW_FLOAT )
+		ok = SteamUserStats()->SetStat(name, (float)value);
+	else
+		ok = value != 0 ? SteamUserStats()->SetAchievement(name) : SteamUserStats()->ClearAchievement(name);
+	if( !ok ) return false;
+	if( kind == SHADOW_ACHIEVEMENT )
+		s_dirtyAchievements.insert(name);
+	else
+		s_dirtyStats.insert(name);
+	return true;
 }
 
+// reads are served by the shadow when it knows the value, the values read from Steam are kept there
+static bool get_value( const char *name, int kind, double *value ) {
+	if( shadow_get(name, value) ) return true;
+	if( !CheckInit() || !steam_get_value(name, kind, value) ) return false;
+	shadow_set(name, kind, *value, true);
+	return true;
+}
 
-static std::string toLeaderboardScore(const char* leaderboardName, int score, int detail, int rank){
-	std::ostringstream data;
-	data << leaderboardName << "," << score << "," << detail << "," << rank;
-	return data.str();
+// while Steam is unavailable, the shadow keeps the value until it can be stored
+static bool set_value( const char *name, int kind, double value ) {
+	if( kind == SHADOW_INT ) value = (int32)value; else if( kind == SHADOW_FLOAT ) value = (float)value;
+	shadow_set(name, kind, value, false);
+	if( !CheckInit() ) return shadow_enabled();
+	return steam_set_value(name, kind, value);
 }
 
-void CallbackHandler::OnScoreUploaded(LeaderboardScoreUploaded_t *pCallback, bool bIOFailure){
-	if (pCallback->m_bSuccess && !bIOFailure){
-		std::string leaderboardName = SteamUserStats()->GetLeaderboardName(pCallback->m_hSteamLeaderboard);
-		std::string data = toLeaderboardScore(SteamUserStats()->GetLeaderboardName(pCallback->m_hSteamLeaderboard), pCallback->m_nScore, -1, pCallback->m_nGlobalRankNew);
-		SendEvent(ScoreUploaded, true, data.c_str());
-	}else if (pCallback != NULL && pCallback->m_hSteamLeaderboard != 0) {
-		SendEvent(ScoreUploaded, false, SteamUserStats()->GetLeaderboardName(pCallback->m_hSteamLeaderboard));
-	}else{
-		SendEvent(ScoreUploaded, false, NULL);
+// once the current stats are received : the values changed offline are set again, the others are refreshed from Steam
+static void shadow_resync() {
+	std::map<std::string, shadow_value> &values = shadow_values();
+	for(std::map<std::string, shadow_value>::iterator it = values.begin(); it != values.end(); ++it) {
+		const char *name = it->first.c_str();
+		shadow_value v = it->second;
+		if( !v.synced ) {
+			if( steam_set_value(name, v.kind, v.value) ) s_storeWanted = true;
+		}
+		else if( steam_get_value(name, v.kind, &v.value) )
+			shadow_set(name, v.kind, v.value, true);
 	}
 }
 
-bool CallbackHandler::DownloadScores(const std::string& leaderboardId, int numBefore, int numAfter){
-   	if (m_leaderboards.find(leaderboardId) == m_leaderboards.end() || m_leaderboards[leaderboardId] == 0)
-   		return false;
-
- 	// load the specified leaderboard data around the current user
- 	SteamAPICall_t hSteamAPICall = SteamUserStats()->DownloadLeaderboardEntries(m_leaderboards[leaderboardId], k_ELeaderboardDataRequestGlobalAroundUser, -numBefore, numAfter);
-	m_callResultDownloadScore.Set(hSteamAPICall, this, &CallbackHandler::OnScoreDownloaded);
-
- 	return true;
+// called after each run of the callbacks, force sends the changes right away (on shutdown)
+void stats_update( bool force ) {
+	int64 now = profile_now();
+	shadow_flush();
+	if( !SteamUser()->BLoggedOn() )
+		s_statsReceived = false;
+	else if( !s_statsReceived && shadow_unsynced() && (now - s_lastStatsRequest) / 1e9 >= STATS_STORE_TIMEOUT ) {
+		// back online with offline progress : it is resynced when the current stats are received
+		s_lastStatsRequest = now;
+		SteamUserStats()->RequestCurrentStats();
+	}
+	double elapsed = (now - s_lastStore) / 1e9;
+	if( s_storing ) {
+		if( !force && elapsed < STATS_STORE_TIMEOUT ) return;
+		store_done(true);
+	}
+	if( !s_storeWanted && s_dirtyAchievements.empty() )
+		return;
+	if( !force && s_lastStore && elapsed < s_storeInterval )
+		return;
+	s_lastStore = now;
+	// fails until the current stats have been received, we will try again after the interval
+	if( !SteamUserStats()->StoreStats() )
+		return;
+	s_storing = true;
+	s_storeWanted = false;
+	merge_names(s_storingStats, s_dirtyStats);
+	merge_names(s_storingAchievements, s_dirtyAchievements);
 }
 
-void CallbackHandler::OnScoreDownloaded(LeaderboardScoresDownloaded_t *pCallback, bool bIOFailure){
-	if (bIOFailure)	{
-		SendEvent(ScoreDownloaded, false, NULL);
-		return;
+void CallbackHandler::OnUserStatsReceived( UserStatsReceived_t *pCallback ){
+ 	if (pCallback->m_nGameID != SteamUtils()->GetAppID()) return;
+	reset_stat_schema();
+	if( pCallback->m_eResult == k_EResultOK ) {
+		s_statsReceived = true;
+		shadow_resync();
 	}
+	SendEvent(UserStatsReceived, pCallback->m_eResult == k_EResultOK, NULL);
+}
 
-	std::string leaderboardId = SteamUserStats()->GetLeaderboardName(pCallback->m_hSteamLeaderboard);
-
-	int numEntries = pCallback->m_cEntryCount;
-	if (numEntries > 10) numEntries = 10;
-
-	std::ostringstream data;
-	bool haveData = false;
-
-	for (int i=0; i<numEntries; i++){
-		int score = 0;
-		int details[1];
-		LeaderboardEntry_t entry;
-		SteamUserStats()->GetDownloadedLeaderboardEntry(pCallback->m_hSteamLeaderboardEntries, i, &entry, details, 1);
-		if (entry.m_cDetails != 1) continue;
-
-		if (haveData)
-			data << ";";
-		data << toLeaderboardScore(leaderboardId.c_str(), entry.m_nScore, details[0], entry.m_nGlobalRank).c_str();
-		haveData = true;
-	}
+void CallbackHandler::OnUserStatsStored( UserStatsStored_t *pCallback ){
+ 	if (pCallback->m_nGameID != SteamUtils()->GetAppID()) return;
+	// InvalidParam : some stats were rejected and reverted, storing them again would fail the same way
+	if( s_storing ) store_done(pCallback->m_eResult != k_EResultOK && pCallback->m_eResult != k_EResultInvalidParam);
+	SendEvent(UserStatsStored, pCallback->m_eResult == k_EResultOK, NULL);
+}
 
-	if (haveData)
-		SendEvent(ScoreDownloaded, true, data.str().c_str());
-	else
-		SendEvent(ScoreDownloaded, true, toLeaderboardScore(leaderboardId.c_str(), -1, -1, -1).c_str());
+void CallbackHandler::OnAchievementStored( UserAchievementStored_t *pCallback ){
+ 	if (pCallback->m_nGameID != SteamUtils()->GetAppID()) return;
+	SendEvent(UserAchievementStored, true, pCallback->m_rgchAchievementName);
 }
 
-void CallbackHandler::RequestGlobalStats(){
- 	SteamAPICall_t hSteamAPICall = SteamUserStats()->RequestGlobalStats(0);
+void CallbackHandler::RequestGlobalStats( int historyDays ){
+ 	SteamAPICall_t hSteamAPICall = SteamUserStats()->RequestGlobalStats(historyDays);
  	m_callResultRequestGlobalStats.Set(hSteamAPICall, this, &CallbackHandler::OnGlobalStatsReceived);
+	track_call_result(hSteamAPICall, CALLBACK_BASE(&m_callResultRequestGlobalStats));
 }
 
 void CallbackHandler::OnGlobalStatsReceived(GlobalStatsReceived_t* pResult, bool bIOFailure){
 	if (!bIOFailure){
 		if (pResult->m_nGameID != SteamUtils()->GetAppID()) return;
+		if( pResult->m_eResult == k_EResultOK ) reset_global_stats();
 		SendEvent(GlobalStatsReceived, pResult->m_eResult == k_EResultOK, NULL);
 	}else{
 		SendEvent(GlobalStatsReceived, false, NULL);
@@ -128,56 +184,139 @@ HL_PRIM bool HL_NAME(request_stats)(){
 DEFINE_PRIM(_BOOL, request_stats, _NO_ARG);
 
 HL_PRIM int HL_NAME(get_stat_int)(vbyte *name){
-	if (!CheckInit()) return 0;
-
-	int val = 0;
-	SteamUserStats()->GetStat((char*)name, &val);
-	return val;
+	double val = 0;
+	get_value((char*)name, SHADOW_INT, &val);
+	return (int)val;
 }
 DEFINE_PRIM(_I32, get_stat_int, _BYTES);
 
 HL_PRIM double HL_NAME(get_stat_float)(vbyte *name){
-	if (!CheckInit()) return 0.0;
-
-	float val = 0.0;
-	SteamUserStats()->GetStat((char*)name, &val);
-	return (double)val;
+	double val = 0.0;
+	get_value((char*)name, SHADOW_FLOAT, &val);
+	return val;
 }
 DEFINE_PRIM(_F64, get_stat_float, _BYTES);
 
 HL_PRIM bool HL_NAME(set_stat_int)(vbyte *name, int val){
-	if (!CheckInit()) return false;
-	return SteamUserStats()->SetStat((char*)name, val);
+	if( !set_value((char*)name, SHADOW_INT, val) ) return false;
+	stat_changed((char*)name);
+	return true;
 }
 DEFINE_PRIM(_BOOL, set_stat_int, _BYTES _I32);
 
 HL_PRIM bool HL_NAME(set_stat_float)(vbyte *name, double val){
-	if (!CheckInit()) return false;
-	return SteamUserStats()->SetStat((char*)name, (float)val);
+	if( !set_value((char*)name, SHADOW_FLOAT, val) ) return false;
+	stat_changed((char*)name);
+	return true;
 }
 DEFINE_PRIM(_BOOL, set_stat_float, _BYTES _F64);
 
+// the store is sent by stats_update, within the interval
 HL_PRIM bool HL_NAME(store_stats)(){
 	if (!CheckInit()) return false;
-	return SteamUserStats()->StoreStats();
+	s_storeWanted = true;
+	return true;
 }
 DEFINE_PRIM(_BOOL, store_stats, _NO_ARG);
 
+HL_PRIM void HL_NAME(set_stats_store_interval)( double seconds ){
+	s_storeInterval = seconds;
+}
+DEFINE_PRIM(_VOID, set_stats_store_interval, _F64);
+
+// returns the number of stats waiting for a store, and the number of changes being stored
+HL_PRIM int HL_NAME(get_pending_stats)( int *achievements, int *storing ){
+	*achievements = (int)s_dirtyAchievements.size();
+	*storing = (int)(s_storingStats.size() + s_storingAchievements.size());
+	return (int)s_dirtyStats.size();
+}
+DEFINE_PRIM(_I32, get_pending_stats, _REF(_I32) _REF(_I32));
+
 //-----------------------------------------------------------------------------------------------------------
 
-HL_PRIM bool HL_NAME(set_achievement)(vbyte *name){
-	if (!CheckInit()) return false;
+// Stat schema : the stats registered once get an index, and are then read or written all together from an
+// array of doubles (exact for int stats). Only the stats whose value changed are set and marked dirty.
+typedef struct {
+	std::string name;
+	bool isFloat;
+	double last; // NaN until read or written
+} stat_def;
+
+static std::vector<stat_def> s_statSchema;
+static std::map<std::string, int> s_statIndexes;
+
+// a stat set by name or received from Steam is no longer known to the schema
+static void stat_changed( const char *name ) {
+	std::map<std::string, int>::iterator it = s_statIndexes.find(name);
+	if( it != s_statIndexes.end() )
+		s_statSchema[it->second].last = NAN;
+}
+
+static void reset_stat_schema() {
+	for(int i=0;i<(int)s_statSchema.size();i++)
+		s_statSchema[i].last = NAN;
+}
+
+HL_PRIM int HL_NAME(register_stat)( vbyte *name, bool isFloat ){
+	std::map<std::string, int>::iterator it = s_statIndexes.find((char*)name);
+	if( it != s_statIndexes.end() )
+		return it->second;
+	stat_def d;
+	d.name = (char*)name;
+	d.isFloat = isFloat;
+	d.last = NAN;
+	s_statSchema.push_back(d);
+	s_statIndexes[d.name] = (int)s_statSchema.size() - 1;
+	return (int)s_statSchema.size() - 1;
+}
+DEFINE_PRIM(_I32, register_stat, _BYTES _BOOL);
+
+// reads the stats [start, start + count), returns the number of stats that could be read
+HL_PRIM int HL_NAME(get_stats)( double *values, int start, int count ){
+	if( start < 0 || start + count > (int)s_statSchema.size() ) return 0;
+	int read = 0;
+	for(int i=0;i<count;i++) {
+		stat_def *d = &s_statSchema[start + i];
+		values[i] = 0;
+		if( !get_value(d->name.c_str(), d->isFloat ? SHADOW_FLOAT : SHADOW_INT, &values[i]) ) continue;
+		d->last = values[i];
+		read++;
+	}
+	return read;
+}
+DEFINE_PRIM(_I32, get_stats, _BYTES _I32 _I32);
+
+// sets the stats [start, start + count) that changed, returns their number or -1 if one of them failed
+HL_PRIM int HL_NAME(set_stats)( double *values, int start, int count ){
+	if( start < 0 || start + count > (int)s_statSchema.size() ) return -1;
+	int changed = 0;
+	bool failed = false;
+	for(int i=0;i<count;i++) {
+		stat_def *d = &s_statSchema[start + i];
+		double v = values[i];
+		if( v == d->last ) continue;
+		if( !set_value(d->name.c_str(), d->isFloat ? SHADOW_FLOAT : SHADOW_INT, v) ) {
+			failed = true;
+			continue;
+		}
+		d->last = v;
+		changed++;
+	}
+	return failed ? -1 : changed;
+}
+DEFINE_PRIM(_I32, set_stats, _BYTES _I32 _I32);
+
+//-----------------------------------------------------------------------------------------------------------
 
-	SteamUserStats()->SetAchievement((char*)name);
-	return SteamUserStats()->StoreStats();
+HL_PRIM bool HL_NAME(set_achievement)(vbyte *name){
+	return set_value((char*)name, SHADOW_ACHIEVEMENT, 1);
 }
 DEFINE_PRIM(_BOOL, set_achievement, _BYTES);
 
 HL_PRIM bool HL_NAME(get_achievement)(vbyte *name) {
-  if (!CheckInit()) return false;
-  bool achieved = false;
-  SteamUserStats()->GetAchievement((char*)name, &achieved);
-  return achieved;
+  double achieved = 0;
+  get_value((char*)name, SHADOW_ACHIEVEMENT, &achieved);
+  return achieved != 0;
 }
 DEFINE_PRIM(_BOOL, get_achievement, _BYTES);
 
@@ -200,9 +339,7 @@ HL_PRIM vbyte *HL_NAME(get_achievement_name)(int index){
 DEFINE_PRIM(_BYTES, get_achievement_name, _I32);
 
 HL_PRIM bool HL_NAME(clear_achievement)(vbyte *name){
-	if (!CheckInit()) return false;
-	SteamUserStats()->ClearAchievement((char*)name);
-	return SteamUserStats()->StoreStats();
+	return set_value((char*)name, SHADOW_ACHIEVEMENT, 0);
 }
 DEFINE_PRIM(_BOOL, clear_achievement, _BYTES);
 
@@ -214,37 +351,111 @@ DEFINE_PRIM(_BOOL, indicate_achievement_progress, _BYTES _I32 _I32);
 
 //-----------------------------------------------------------------------------------------------------------
 
-HL_PRIM bool HL_NAME(find_leaderboard)(vbyte *name) {
-	if (!CheckInit()) return false;
-	s_callbackHandler->FindLeaderboard((char*)name);
- 	return true;
+// Global stats : the values read are cached until the next GlobalStatsReceived, as they can't change before.
+// A stat is its total followed by its daily history, most recent day first. Int stats are 64 bits.
+#define GLOBAL_STATS_HISTORY_MAX	60
+
+typedef union {
+	int64 i;
+	double f;
+} global_value;
+
+typedef struct {
+	bool ok;
+	int days; // number of history days asked
+	global_value total;
+	std::vector<global_value> history;
+} global_stat;
+
+static std::map<std::string, global_stat> s_globalStats[2]; // int, float
+static int s_globalStatsGeneration = 0;
+
+static void reset_global_stats() {
+	s_globalStats[0].clear();
+	s_globalStats[1].clear();
+	s_globalStatsGeneration++;
 }
-DEFINE_PRIM(_BOOL, find_leaderboard, _BYTES);
 
-HL_PRIM bool HL_NAME(upload_score)(vbyte *name, int score, int detail){
-	if (!CheckInit()) return false;
-	return s_callbackHandler->UploadScore((char*)name, score, detail);
-}
-DEFINE_PRIM(_BOOL, upload_score, _BYTES _I32 _I32);
-
-HL_PRIM bool HL_NAME(download_scores)(vbyte *name, int numBefore, int numAfter) {
-	if (!CheckInit()) return false;
-	return s_callbackHandler->DownloadScores((char*)name, numBefore, numAfter);
+static global_stat *read_global_stat( const char *name, bool isFloat, int days ) {
+	if( days > GLOBAL_STATS_HISTORY_MAX ) days = GLOBAL_STATS_HISTORY_MAX;
+	std::map<std::string, global_stat> &cache = s_globalStats[isFloat ? 1 : 0];
+	std::map<std::string, global_stat>::iterator it = cache.find(name);
+	if( it != cache.end() && it->second.days >= days )
+		return &it->second;
+	global_stat *s = &cache[name];
+	s->days = days;
+	s->total.i = 0;
+	s->ok = isFloat ? SteamUserStats()->GetGlobalStat(name, &s->total.f) : SteamUserStats()->GetGlobalStat(name, &s->total.i);
+	s->history.resize(days);
+	int count = 0;
+	if( s->ok && days > 0 ) {
+		if( isFloat )
+			count = SteamUserStats()->GetGlobalStatHistory(name, (double*)&s->history[0], days * sizeof(double));
+		else
+			count = SteamUserStats()->GetGlobalStatHistory(name, (int64*)&s->history[0], days * sizeof(int64));
+	}
+	s->history.resize(count < 0 ? 0 : count);
+	return s;
 }
-DEFINE_PRIM(_BOOL, download_scores, _BYTES _I32 _I32);
 
-HL_PRIM bool HL_NAME(request_global_stats)() {
+HL_PRIM bool HL_NAME(request_global_stats)( int historyDays ) {
 	if (!CheckInit()) return false;
-	s_callbackHandler->RequestGlobalStats();
+	if( historyDays > GLOBAL_STATS_HISTORY_MAX ) historyDays = GLOBAL_STATS_HISTORY_MAX;
+	s_callbackHandler->RequestGlobalStats(historyDays < 0 ? 0 : historyDays);
 	return true;
 }
-DEFINE_PRIM(_BOOL, request_global_stats, _NO_ARG);
+DEFINE_PRIM(_BOOL, request_global_stats, _I32);
 
-HL_PRIM int HL_NAME(get_global_stat)(vbyte *name){
+// returns the low 32 bits of the value, and its high ones in high
+HL_PRIM int HL_NAME(get_global_stat)(vbyte *name, int *high){
+	*high = 0;
 	if (!CheckInit()) return 0;
-
-	int64 val;
-	SteamUserStats()->GetGlobalStat((char*)name, &val);
+	int64 val = read_global_stat((char*)name, false, 0)->total.i;
+	*high = (int)(val >> 32);
 	return (int)val;
 }
-DEFINE_PRIM(_I32, get_global_stat, _BYTES);
+DEFINE_PRIM(_I32, get_global_stat, _BYTES _REF(_I32));
+
+HL_PRIM double HL_NAME(get_global_stat_float)(vbyte *name){
+	if (!CheckInit()) return 0.;
+	return read_global_stat((char*)name, true, 0)->total.f;
+}
+DEFINE_PRIM(_F64, get_global_stat_float, _BYTES);
+
+// Reads count stats in one call, names being the list of their zero terminated names. For each stat, values receives
+// its total then days of history (zero past the history available), and days the number of history days available,
+// or -1 if the stat is unavailable. Returns the number of stats available.
+HL_PRIM int HL_NAME(get_global_stats)( vbyte *names, int count, bool isFloat, int days, vbyte *values, int *available ) {
+	if( days < 0 ) days = 0;
+	int stride = days + 1;
+	memset(values, 0, (size_t)count * stride * sizeof(global_value));
+	if( !CheckInit() ) {
+		for(int i=0;i<count;i++) available[i] = -1;
+		return 0;
+	}
+	global_value *out = (global_value*)values;
+	const char *name = (char*)names;
+	int read = 0;
+	for(int i=0;i<count;i++) {
+		global_stat *s = read_global_stat(name, isFloat, days);
+		name += strlen(name) + 1;
+		if( !s->ok ) {
+			available[i] = -1;
+			continue;
+		}
+		int n = (int)s->history.size();
+		if( n > days ) n = days;
+		out[i * stride] = s->total;
+		if( n ) memcpy(out + i * stride + 1, &s->history[0], n * sizeof(global_value));
+		available[i] = n;
+		read++;
+	}
+	return read;
+}
+DEFINE_PRIM(_I32, get_global_stats, _BYTES _I32 _BOOL _I32 _BYTES _BYTES);
+
+// changes each time new global stats are received
+HL_PRIM int HL_NAME(get_global_stats_generation)() {
+	return s_globalStatsGeneration;
+}
+DEFINE_PRIM(_I32, get_global_stats_generation, _NO_ARG);
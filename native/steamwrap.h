@@ -15,6 +15,12 @@
 #include <steam/steam_gameserver.h>
 #include <steam/isteamappticket.h>
 
+// ISteamNetworkingMessages and manual callback dispatch are only available with recent SDKs
+#ifdef STEAMNETWORKINGMESSAGES_INTERFACE_VERSION
+#	define STEAM_NETWORKING_MESSAGES
+#	define STEAM_MANUAL_DISPATCH
+#endif
+
 typedef vbyte *		vuid;
 #define _UID		_BYTES
 #define hlt_uid		hlt_bytes
@@ -25,32 +31,254 @@ CSteamID hl_to_uid( vuid v );
 vuid hl_of_uid( CSteamID id );
 uint64 hl_to_uint64(vuid v);
 vuid hl_of_uint64(uint64 id);
+void hl_write_uid( vuid out, uint64 id );
+
+// interned ids, see common.cpp : a 64 bits id passed as a small index, without allocating
+#define _ID			_I32
+int hl_intern_id( uint64 id );
+uint64 hl_id_value( int id );
+
+// P2PSessionConnectFail_t error for a messages session end reason, see networking.cpp
+int session_error( int reason );
+
+// callback profiling, see profile.cpp : timestamps are 0 while it is disabled
+extern bool s_profiling;
+int64 profile_now();
+inline int64 profile_start() { return s_profiling ? profile_now() : 0; }
+void profile_callback( int id, bool server, int64 start, int64 encoded );
+void profile_call_result( int id, int64 issued, int64 start );
+void untrack_call_result( SteamAPICall_t call );
 
 template< class T >
 class CClosureCallResult : public CCallResult<CClosureCallResult<T>,T> {
 	vclosure *closure;
 	void (*on_result)( vclosure *, T *, bool);
+	int64 issued;
 public:
+	SteamAPICall_t handle;
 	CClosureCallResult( vclosure *cval, void (*on_result)( vclosure *t, T*, bool) ) {
+		this->handle = k_uAPICallInvalid;
 		this->closure = cval;
 		this->on_result = on_result;
+		this->issued = profile_start();
 		hl_add_root(&closure);
 	}
+	// cancelled or done : the router must no longer run it
 	~CClosureCallResult() {
+		untrack_call_result(handle);
 		hl_remove_root(&closure);
 	}
 	void OnResult( T *result, bool onIOError ) {
+		int64 start = profile_start();
 		on_result(closure,result,onIOError);
+		profile_call_result(T::k_iCallback, issued, start);
 		delete this;}
 };
 
+// manual dispatch, see dispatch.cpp : Steam no longer runs the callbacks and call results, they are
+// routed to the CCallback/CCallResult objects we registered. CCallbackBase is a private base of these.
+#define CALLBACK_BASE(cb)	((CCallbackBase*)(cb))
+
+void route_callback( int id, CCallbackBase *cb, bool server );
+void track_call_result( SteamAPICall_t call, CCallbackBase *cb );
+void stats_update( bool force );
+
+// stats shadow, see shadow.cpp
+enum { SHADOW_INT, SHADOW_FLOAT, SHADOW_ACHIEVEMENT };
+typedef struct {
+	int kind;
+	double value;
+	bool synced; // stored by Steam
+} shadow_value;
+
+bool shadow_enabled();
+std::map<std::string, shadow_value> &shadow_values();
+bool shadow_get( const char *name, double *value );
+void shadow_set( const char *name, int kind, double value, bool synced );
+void shadow_synced( const char *name );
+int shadow_unsynced();
+void shadow_flush();
+
+extern bool manual_dispatch_global;
+bool manual_dispatch_init( bool server );
+void manual_dispatch_reset( bool server );
+bool manual_dispatch_enabled( bool server );
+int manual_dispatch_run( bool server, int budget );
+
 #define ASYNC_CALL(steam_call, type, on_result) \
 	CClosureCallResult<type> *m_call = new CClosureCallResult<type>(closure,on_result); \
-	m_call->Set(steam_call, m_call, &CClosureCallResult<type>::OnResult);
+	SteamAPICall_t m_handle = steam_call; \
+	m_call->Set(m_handle, m_call, &CClosureCallResult<type>::OnResult); \
+	m_call->handle = m_handle; \
+	track_call_result(m_handle, CALLBACK_BASE(m_call));
 
 #define _CRESULT	_ABSTRACT(steam_call_result)
 #define _CALLB(T)	_FUN(_VOID, T _BOOL)
 
+// typed events : the event is written in place into a preallocated HL object, whose layout
+// starts with the steam.Event fields, which is then passed to a typed closure (see Api.registerTypedEvent)
+typedef struct {
+	hl_type *t;
+	int id;
+} event_obj;
+
+// P2P and messages session events, shared by the client and the game server
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid uid;
+} session_request_obj;
+
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid uid;
+	int error;
+	int reason;
+} session_failed_obj;
+
+typedef struct {
+	event_obj *obj;
+	vclosure *callb;
+} typed_event;
+
+class TypedEvents {
+	std::map<int, typed_event> events;
+public:
+	typed_event *Get( int id ) {
+		if( events.empty() ) return NULL;
+		std::map<int, typed_event>::iterator it = events.find(id);
+		return it == events.end() ? NULL : &it->second;
+	}
+	// a NULL callb removes the event, which is then sent to the global event handler again
+	void Register( int id, event_obj *obj, vclosure *callb ) {
+		std::map<int, typed_event>::iterator it = events.find(id);
+		if( it != events.end() ) {
+			hl_remove_root(&it->second.obj);
+			hl_remove_root(&it->second.callb);
+			events.erase(it);
+		}
+		if( !callb || !obj ) return;
+		typed_event *e = &events[id];
+		obj->id = id;
+		e->obj = obj;
+		e->callb = callb;
+		hl_add_root(&e->obj);
+		hl_add_root(&e->callb);
+	}
+	static void Call( typed_event *e ) {
+		vclosure *c = e->callb;
+		if( c->hasValue )
+			((void(*)(void*, event_obj*))c->fun)(c->value, e->obj);
+		else
+			((void(*)(event_obj*))c->fun)(e->obj);
+	}
+};
+
+#define _EVENT		_OBJ(_I32)
+
+// global events that have a registered handler, by k_iCallback : the others are not encoded
+// ids out of the mask range are always considered listened to
+#define EVENT_MASK_SIZE		8192
+
+class EventMask {
+	uint32 bits[EVENT_MASK_SIZE >> 5];
+public:
+	EventMask() {
+		memset(bits, 0, sizeof(bits));
+	}
+	void Set( int id, bool b ) {
+		if( id < 0 || id >= EVENT_MASK_SIZE ) return;
+		if( b )
+			bits[id >> 5] |= 1u << (id & 31);
+		else
+			bits[id >> 5] &= ~(1u << (id & 31));
+	}
+	bool Has( int id ) {
+		if( id < 0 || id >= EVENT_MASK_SIZE ) return true;
+		return (bits[id >> 5] >> (id & 31)) & 1;
+	}
+};
+
+#define EVENT_RING_SIZE		(64 << 10)
+#define EVENT_WRAP			-1
+
+// (id, size, data) records, used to queue callbacks
+class EventRing {
+	std::vector<vbyte> data;
+	int read;
+	int write;
+	int used; // including the padding skipped on wrap
+	bool grow;
+	void Grow() {
+		EventRing r((int)data.size() << 1, true);
+		int id, size;
+		vbyte *p;
+		while( (p = Peek(&id, &size)) != NULL ) {
+			r.Push(id, p, size);
+			Pop(size);
+		}
+		data.swap(r.data);
+		read = r.read;
+		write = r.write;
+		used = r.used;
+		count = r.count;
+	}
+public:
+	int count;
+	int dropped;
+	EventRing( int size, bool grow ) : data(size), read(0), write(0), used(0), grow(grow), count(0), dropped(0) {}
+	// fails only if the ring can't grow, records are 8 bytes aligned
+	bool Push( int id, const void *payload, int size ) {
+		int cap = (int)data.size();
+		int rec = 8 + ((size + 7) & ~7);
+		int tail = write + rec > cap ? cap - write : 0;
+		if( used + tail + rec > cap ) {
+			if( !grow ) {
+				dropped++;
+				return false;
+			}
+			Grow();
+			return Push(id, payload, size);
+		}
+		if( tail ) {
+			*(int*)&data[write] = EVENT_WRAP;
+			used += tail;
+			write = 0;
+		}
+		int *h = (int*)&data[write];
+		h[0] = id;
+		h[1] = size;
+		memcpy(h + 2, payload, size);
+		used += rec;
+		write += rec;
+		if( write == cap ) write = 0;
+		count++;
+		return true;
+	}
+	vbyte *Peek( int *id, int *size ) {
+		if( !count ) return NULL;
+		int *h = (int*)&data[read];
+		if( h[0] == EVENT_WRAP ) {
+			used -= (int)data.size() - read;
+			read = 0;
+			h = (int*)&data[0];
+		}
+		*id = h[0];
+		*size = h[1];
+		return (vbyte*)(h + 2);
+	}
+	// the popped record stays valid until the next Push
+	void Pop( int size ) {
+		int rec = 8 + ((size + 7) & ~7);
+		read += rec;
+		used -= rec;
+		if( read == (int)data.size() ) read = 0;
+		if( --count == 0 )
+			read = write = used = 0;
+	}
+};
+
 typedef enum {
 	None,
 	GamepadTextInputDismissed,
@@ -64,76 +292,80 @@ typedef enum {
 } event_type;
 
 class CallbackHandler {
-private:
-	//SteamLeaderboard_t m_curLeaderboard;
-	std::map<std::string, SteamLeaderboard_t> m_leaderboards;
 public:
 
 	CallbackHandler() :
 #	define EVENT_DECL(name,type) m_##name(this,&CallbackHandler::On##name),
 #	include "events.h"
-		m_leaderboards()
+		m_callResultRequestGlobalStats()
 	{}
 
-#	define EVENT_DECL(name,type) STEAM_CALLBACK(CallbackHandler, On##name, type, m_##name); vdynamic *Encode##name( type *t );
+#	define EVENT_DECL(name,type) STEAM_CALLBACK(CallbackHandler, On##name, type, m_##name); vdynamic *Encode##name( type *t ); void Fill##name( event_obj *o, type *t ); void Deliver##name( type *t );
 #	include "events.h"
 
-#	define EVENT_IMPL(name,type) vdynamic *CallbackHandler::Encode##name( type *d )
-
-	void FindLeaderboard(const char* name);
-	void OnLeaderboardFound( LeaderboardFindResult_t *pResult, bool bIOFailure);
-	CCallResult<CallbackHandler, LeaderboardFindResult_t> m_callResultFindLeaderboard;
-
-	bool UploadScore(const std::string& leaderboardId, int score, int detail);
-	void OnScoreUploaded( LeaderboardScoreUploaded_t *pResult, bool bIOFailure);
-	CCallResult<CallbackHandler, LeaderboardScoreUploaded_t> m_callResultUploadScore;
+	void Dispatch( int id, void *data );
+	void RouteCallbacks();
 
-	bool DownloadScores(const std::string& leaderboardId, int numBefore, int numAfter);
-	void OnScoreDownloaded( LeaderboardScoresDownloaded_t *pResult, bool bIOFailure);
-	CCallResult<CallbackHandler, LeaderboardScoresDownloaded_t> m_callResultDownloadScore;
+#	define EVENT_IMPL(name,type) vdynamic *CallbackHandler::Encode##name( type *d )
 
-	void RequestGlobalStats();
+	void RequestGlobalStats( int historyDays );
 	void OnGlobalStatsReceived(GlobalStatsReceived_t* pResult, bool bIOFailure);
 	CCallResult<CallbackHandler, GlobalStatsReceived_t> m_callResultRequestGlobalStats;
 
 };
 
+// a field name hashed once, see fields.h
+class HLField {
+public:
+	int hash;
+	HLField( const char *name ) : hash(hl_hash_utf8(name)) {}
+};
+
+#define FIELD_DECL(name) extern HLField field_##name;
+#include "fields.h"
+
 class HLValue {
 public:
 	vdynamic *value;
 	HLValue() {
 		value = (vdynamic*)hl_alloc_dynobj();
 	}
-	void Set( const char *name, CSteamID uid ) {
-		hl_dyn_setp(value, hl_hash_utf8(name), &hlt_uid, hl_of_uid(uid));
+	void Set( const HLField &f, CSteamID uid ) {
+		hl_dyn_setp(value, f.hash, &hlt_uid, hl_of_uid(uid));
+	}
+	void Set( const HLField &f, uint64 uid ) {
+		hl_dyn_setp(value, f.hash, &hlt_uid, hl_of_uint64(uid));
 	}
-	void Set( const char *name, uint64 uid ) {
-		hl_dyn_setp(value, hl_hash_utf8(name), &hlt_uid, hl_of_uint64(uid));
+	void Set( const HLField &f, uint32 v ) {
+		Set(f,(int)v);
 	}
-	void Set( const char *name, uint32 v ) {
-		Set(name,(int)v);
+	void Set( const HLField &f, bool b ) {
+		hl_dyn_seti(value, f.hash, &hlt_bool, b);
 	}
-	void Set( const char *name, bool b ) {
-		hl_dyn_seti(value, hl_hash_utf8(name), &hlt_bool, b);
+	void Set( const HLField &f, int v ) {
+		hl_dyn_seti(value, f.hash, &hlt_i32, v);
 	}
-	void Set( const char *name, int v ) {
-		hl_dyn_seti(value, hl_hash_utf8(name), &hlt_i32, v);
+	void Set( const HLField &f, double v ) {
+		hl_dyn_setd(value, f.hash, v);
 	}
-	void Set(const char *name, double v) {
-		hl_dyn_setd(value, hl_hash_utf8(name), v);
+	void Set( const HLField &f, float v ) {
+		hl_dyn_setf(value, f.hash, v);
 	}
-	void Set(const char *name, float v) {
-		hl_dyn_setf(value, hl_hash_utf8(name), v);
+	void Set( const HLField &f, const char *b ) {
+		hl_dyn_setp(value, f.hash, &hlt_bytes, hl_copy_bytes((vbyte*)b, (int)strlen(b)+1));
 	}
-	void Set( const char *name, const char *b ) {
-		hl_dyn_setp(value, hl_hash_utf8(name), &hlt_bytes, hl_copy_bytes((vbyte*)b, (int)strlen(b)+1));
+	void Set( const HLField &f, vdynamic *d ) {
+		hl_dyn_setp(value, f.hash, &hlt_dyn, d);
 	}
-	void Set( const char *name, vdynamic *d ) {
-		hl_dyn_setp(value, hl_hash_utf8(name), &hlt_dyn, d);
+	// hashes the name on each call, use an HLField for events
+	template< typename T > void Set( const char *name, T v ) {
+		Set(HLField(name), v);
 	}
 };
 
 extern CallbackHandler *s_callbackHandler;
+extern TypedEvents s_typedEvents;
+extern EventMask s_eventMask;
 
 void SendEvent(event_type type, bool success, const char *data);
 bool CheckInit();
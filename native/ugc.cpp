@@ -2,16 +2,30 @@
 
 vdynamic *CallbackHandler::EncodeDownloadItem(DownloadItemResult_t *d) {
 	HLValue v;
-	v.Set("file", d->m_nPublishedFileId);
+	v.Set(field_file, d->m_nPublishedFileId);
 	return v.value;
 }
 
 vdynamic *CallbackHandler::EncodeItemInstalled(ItemInstalled_t *d) {
 	HLValue v;
-	v.Set("file", d->m_nPublishedFileId);
+	v.Set(field_file, d->m_nPublishedFileId);
 	return v.value;
 }
 
+typedef struct {
+	hl_type *t;
+	int id;
+	vuid file;
+} item_obj;
+
+void CallbackHandler::FillDownloadItem( event_obj *o, DownloadItemResult_t *d ) {
+	hl_write_uid(((item_obj*)o)->file, d->m_nPublishedFileId);
+}
+
+void CallbackHandler::FillItemInstalled( event_obj *o, ItemInstalled_t *d ) {
+	hl_write_uid(((item_obj*)o)->file, d->m_nPublishedFileId);
+}
+
 HL_PRIM varray *HL_NAME(get_subscribed_items)(){
 	if (!CheckInit()) return NULL;
 
@@ -168,7 +182,21 @@ HL_PRIM CClosureCallResult<GetAppDependenciesResult_t>* HL_NAME(get_app_dependen
 	return m_call;
 }
 
+// writes up to max item ids, returns the number of subscribed items
+HL_PRIM int HL_NAME(get_subscribed_item_ids)( int *out, int max ) {
+	if (!CheckInit()) return 0;
+	int count = SteamUGC()->GetNumSubscribedItems();
+	if( count <= 0 ) return 0;
+	static std::vector<PublishedFileId_t> items;
+	items.resize(count);
+	int result = SteamUGC()->GetSubscribedItems(&items[0], count);
+	for(int i=0;i<result && i<max;i++)
+		out[i] = hl_intern_id(items[i]);
+	return result < 0 ? 0 : result;
+}
+
 DEFINE_PRIM(_ARR, get_subscribed_items, _NO_ARG);
+DEFINE_PRIM(_I32, get_subscribed_item_ids, _BYTES _I32);
 DEFINE_PRIM(_I32, get_item_state, _UID);
 DEFINE_PRIM(_BOOL, get_item_download_info, _UID _REF(_F64) _REF(_F64));
 DEFINE_PRIM(_BOOL, download_item, _UID _BOOL);
@@ -1,15 +1,9 @@
 package steam;
 
 import haxe.Int64;
+import steam.Event;
 import steam.helpers.Util;
 
-private enum LeaderboardOp
-{
-	FIND(id:String);
-	UPLOAD(score:LeaderboardScore);
-	DOWNLOAD(id:String);
-}
-
 @:enum
 abstract SteamNotificationPosition(Int) to Int
 {
@@ -36,6 +30,43 @@ typedef ControllerAnalogActionHandle = Int;
 	var GlobalStatsReceived               = 8;
 }
 
+/**
+	Profile of one callback id as written by `Api.readCallbackStats`, read in place. Times are in seconds.
+	Histogram bucket 0 counts the durations under 1us, and bucket i the ones between 2^(i-1) and 2^i us.
+**/
+abstract CallbackStats(hl.Bytes) {
+
+	public static inline var SIZE = 328;
+	public static inline var BUCKETS = 24;
+
+	public var id(get, never) : Int;
+	/** received by the game server **/
+	public var server(get, never) : Bool;
+	public var count(get, never) : Int;
+	/** number of call results with a known latency **/
+	public var results(get, never) : Int;
+	public var encodeTime(get, never) : Float;
+	public var handlerTime(get, never) : Float;
+	/** total time between the calls and their results **/
+	public var latency(get, never) : Float;
+
+	public inline function new( buffer : hl.Bytes, index : Int ) {
+		this = buffer.offset(index * SIZE);
+	}
+
+	inline function get_id() return this.getI32(0);
+	inline function get_server() return this.getI32(4) != 0;
+	inline function get_count() return this.getI32(8);
+	inline function get_results() return this.getI32(12);
+	inline function get_encodeTime() return this.getF64(16);
+	inline function get_handlerTime() return this.getF64(24);
+	inline function get_latency() return this.getF64(32);
+
+	public inline function getEncode( bucket : Int ) return this.getI32(40 + bucket * 4);
+	public inline function getHandler( bucket : Int ) return this.getI32(136 + bucket * 4);
+	public inline function getLatency( bucket : Int ) return this.getI32(232 + bucket * 4);
+}
+
 @:hlNative("steam")
 class Api
 {
@@ -65,27 +96,26 @@ class Api
 
 	/**
 	 * @param appId_	Your Steam APP ID (the numbers on the end of your store page URL - store.steampowered.com/app/XYZ)
+	 * @param leaderboards	The leaderboards to find right away, see Leaderboard.cacheFile
 	 */
-	public static function init(appId_:Int) {
+	public static function init(appId_:Int, ?leaderboards:Array<String>) {
 		if (active) return true;
 
 		appId = appId_;
-		leaderboardIds = new Array<String>();
-		leaderboardOps = new List<LeaderboardOp>();
 
 		// PersonaStateChange_t
-		registerGlobalEvent(300 + 4, function(data:{user:UID, flags:haxe.EnumFlags<User.Changed>}) {
-			@:privateAccess User.fromUID(data.user).onDataUpdated(data.flags);
+		registerTypedEvent(300 + 4, new PersonaChangeEvent(), function(data) {
+			@:privateAccess User.fromEventUID(data.user).onDataUpdated(data.flags);
 		});
 
 		// GameOverlayActivated_t
-		registerGlobalEvent(300 + 31, function(data:{active: Bool}){
+		registerTypedEvent(300 + 31, new OverlayActivatedEvent(), function(data){
 			if( onOverlay != null )
 				onOverlay( data.active );
 		});
 
 		// GetAuthSessionTicketResponse_t
-		registerGlobalEvent(100 + 63, function(data:{authTicket: Int, result:Int}){
+		registerTypedEvent(100 + 63, new AuthTicketEvent(), function(data){
 			var cb = authTicketCallbacks.get(data.authTicket);
 			if( cb !=null ){
 				cb(data.result == 1);
@@ -100,12 +130,15 @@ class Api
 		if (active) {
 			//customTrace("Steam active");
 			_RequestStats();
-			_RequestGlobalStats();
+			_RequestGlobalStats(0);
 
 			//initialize other API's:
 			controllers = new Controller(customTrace);
 
 			haxe.MainLoop.add(sync);
+
+			if (leaderboards != null)
+				Leaderboard.init(leaderboards);
 		}
 		else {
 			customTrace("Steam failed to activate");
@@ -116,8 +149,91 @@ class Api
 	static var globalEvents = new Map<Int,Dynamic->Void>();
 	static var authTicketCallbacks : Map<Int, Bool->Void> = new Map();
 
+	/**
+		Events with no registered handler are not encoded nor sent by the native side.
+	**/
 	@:noComplete public static function registerGlobalEvent( event : Int, callb : Dynamic -> Void ) {
 		globalEvents.set(event, callb);
+		_SubscribeEvent(event, callb != null);
+	}
+
+	/**
+		Deliver `event` to `callb` by writing it into `obj` instead of allocating an anonymous structure,
+		this takes precedence over `registerGlobalEvent`. The same `obj` is passed for each event.
+		A null `callb` removes the typed handler.
+	**/
+	@:noComplete public static function registerTypedEvent<T:Event>( event : Int, obj : T, callb : T -> Void ) {
+		_RegisterTypedEvent(event, obj, cast callb);
+	}
+
+	static var manualDispatch = false;
+
+	/**
+		Time in microseconds `sync` can spend running callbacks once manual dispatch is enabled, 0 for no limit.
+	**/
+	public static var callbackBudget = 0;
+
+	/**
+		Callbacks left for the next frames by the last `sync`.
+	**/
+	public static var queuedCallbacks(default, null) = 0;
+
+	/**
+		Run the Steam callbacks within `callbackBudget`, to call right after `init`.
+		Returns false if the SDK does not support manual dispatch.
+	**/
+	public static function enableManualDispatch() : Bool {
+		if( !active ) return false;
+		manualDispatch = _InitManualDispatch();
+		return manualDispatch;
+	}
+
+	static var queueEvents = false;
+	static var lowPriorityEvents = -1;
+
+	/**
+		Queue the global events natively while Steam callbacks run, then dispatch them all at once at the end of `sync`.
+		At most `lowPriorityPerFrame` low priority events are dispatched per frame (all if < 0), the others are kept for the next ones.
+	**/
+	public static function setEventQueue( enable : Bool, lowPriorityPerFrame = -1 ) {
+		if( !enable && queueEvents ) _DispatchEvents(-1);
+		queueEvents = enable;
+		lowPriorityEvents = lowPriorityPerFrame;
+		_SetEventQueue(enable);
+	}
+
+	/**
+		Low priority events can be deferred by the event queue, and are dropped when their queue is full (see `getDroppedEvents`).
+	**/
+	public static function setEventPriority( event : Int, low : Bool ) {
+		_SetEventPriority(event, low);
+	}
+
+	/**
+		Measure the number of calls, encode and handler times of each callback, and the latency of the call results.
+	**/
+	public static function setProfiling( enable : Bool ) {
+		_SetProfiling(enable);
+	}
+
+	/**
+		Write the profile of up to `maxCallbacks` callbacks into `buffer` (`CallbackStats.SIZE` bytes each),
+		returns the number of profiled callbacks, which can be more than `maxCallbacks`.
+	**/
+	public static function readCallbackStats( buffer : hl.Bytes, maxCallbacks : Int ) : Int {
+		return _ReadCallbackStats(buffer, maxCallbacks);
+	}
+
+	public static function resetCallbackStats() {
+		_ResetCallbackStats();
+	}
+
+	public static function getQueuedEvents() : Int {
+		return _GetQueuedEvents();
+	}
+
+	public static function getDroppedEvents() : Int {
+		return _GetDroppedEvents();
 	}
 
 	static function onGlobalEvent( event : Int, data : Dynamic ) {
@@ -133,12 +249,12 @@ class Api
 
 	public static function sync() {
 		if (!active) return;
-		_RunCallbacks();
-
-		if (wantStoreStats) {
-			wantStoreStats = false;
-			_StoreStats();
-		}
+		if (manualDispatch)
+			queuedCallbacks = _RunManualCallbacks(callbackBudget);
+		else
+			_RunCallbacks();
+		if (queueEvents)
+			_DispatchEvents(lowPriorityEvents);
 	}
 
 	/*************PUBLIC***************/
@@ -154,18 +270,28 @@ class Api
 
 	public static function downloadLeaderboardScore(id:String):Bool {
 		if (!active) return false;
-		var startProcessingNow = (leaderboardOps.length == 0);
-		findLeaderboardIfNecessary(id);
-		leaderboardOps.add(LeaderboardOp.DOWNLOAD(id));
-		if (startProcessingNow) processNextLeaderboardOp();
+		withLeaderboard(id, function(board) {
+			board.download(AroundUser, 0, 0, function(entries) {
+				report("Leaderboard.DOWNLOAD", [id], entries != null);
+				if (entries == null || whenLeaderboardScoreDownloaded == null) return;
+				if (entries.length == 0)
+					whenLeaderboardScoreDownloaded(new LeaderboardScore(id, -1, -1, -1));
+				for (i in 0...entries.length)
+					whenLeaderboardScoreDownloaded(entries.toScore(i));
+			});
+		});
 		return true;
 	}
 
-	private static function findLeaderboardIfNecessary(id:String) {
-		if (!Lambda.has(leaderboardIds, id) && !Lambda.exists(leaderboardOps, function(op) { return Type.enumEq(op, FIND(id)); }))
-		{
-			leaderboardOps.add(LeaderboardOp.FIND(id));
-		}
+	/**
+	 * Run `f` once the leaderboard is found, immediately if it was already.
+	 */
+	private static function withLeaderboard(id:String, f:Leaderboard->Void) {
+		var board = Leaderboard.get(id);
+		board.resolve(function(found) {
+			if (!found) report("Leaderboard.FIND", [id], false);
+			else f(board);
+		});
 	}
 
 	/**
@@ -371,16 +497,79 @@ class Api
 		return active && report("setStatInt", [id, Std.string(val)], _SetStatInt(@:privateAccess id.toUtf8(), val));
 	}
 
+	/**
+	 * Ask for the changed stats to be stored. Stores are coalesced : all the changes made until then
+	 * are sent together, at most once per `setStatsStoreInterval`, and retried if they fail.
+	 * Achievements don't need it, they are stored as soon as the interval allows.
+	 */
 	public static function storeStats():Bool {
 		return active && report("storeStats", [], _StoreStats());
 	}
 
+	/**
+	 * Minimum delay between two stats stores, 1 second by default.
+	 */
+	public static function setStatsStoreInterval(seconds:Float) {
+		_SetStatsStoreInterval(seconds);
+	}
+
+	/**
+	 * The stats and achievements changes not stored yet, `storing` being the ones of the store in progress.
+	 */
+	public static function getPendingStats() : { stats : Int, achievements : Int, storing : Int } {
+		var achievements = 0, storing = 0;
+		var stats = _GetPendingStats(achievements, storing);
+		return { stats : stats, achievements : achievements, storing : storing };
+	}
+
+	/**
+	 * Keep the stats and achievements in a shadow file : they are then read locally, and can still be set while Steam
+	 * is offline. The offline changes survive a crash or a restart, and are stored once Steam is back.
+	 * Should be called right after `init`, returns false if the file can't be written.
+	 */
+	public static function openStatsShadow(path:String):Bool {
+		return active && _OpenStatsShadow(@:privateAccess path.toUtf8());
+	}
+
+	public static function closeStatsShadow() {
+		_CloseStatsShadow();
+	}
+
+	/**
+	 * The number of stats and achievements of the shadow that Steam did not store yet.
+	 */
+	public static function getUnsyncedStats():Int {
+		return _GetUnsyncedStats();
+	}
+
+	/**
+	 * Request the global stats again, with up to 60 days of daily history (see `GlobalStats`).
+	 */
+	public static function requestGlobalStats(historyDays:Int = 0):Bool {
+		return active && report("requestGlobalStats", [Std.string(historyDays)], _RequestGlobalStats(historyDays));
+	}
+
+	public static function getGlobalStatInt64(id:String):Int64 {
+		if (!active) return 0;
+		var high = 0;
+		var low = _GetGlobalStat(@:privateAccess id.toUtf8(), high);
+		return Int64.make(high, low);
+	}
+
+	public static function getGlobalStatFloat(id:String):Float {
+		if (!active) return 0;
+		return _GetGlobalStatFloat(@:privateAccess id.toUtf8());
+	}
+
 	public static function uploadLeaderboardScore(score:LeaderboardScore):Bool {
 		if (!active) return false;
-		var startProcessingNow = (leaderboardOps.length == 0);
-		findLeaderboardIfNecessary(score.leaderboardId);
-		leaderboardOps.add(LeaderboardOp.UPLOAD(score));
-		if (startProcessingNow) processNextLeaderboardOp();
+		var details = score.details.length > 0 ? score.details : [score.detail];
+		withLeaderboard(score.leaderboardId, function(board) {
+			board.upload(score.score, details, KeepBest, function(result) {
+				report("Leaderboard.UPLOAD", [score.toString()], result != null);
+				if (result != null && whenLeaderboardScoreUploaded != null) whenLeaderboardScoreUploaded(result);
+			});
+		});
 		return true;
 	}
 
@@ -420,32 +609,11 @@ class Api
 
 	private static var haveGlobalStats:Bool;
 	private static var haveReceivedUserStats:Bool;
-	private static var wantStoreStats:Bool;
-
-	private static var leaderboardIds:Array<String>;
-	private static var leaderboardOps:List<LeaderboardOp>;
 
 	public static dynamic function customTrace(str:String) {
 		Sys.println(str);
 	}
 
-	private static function processNextLeaderboardOp() {
-		var op = leaderboardOps.pop();
-		if (op == null) return;
-
-		switch (op) {
-			case FIND(id):
-				if (!report("Leaderboard.FIND", [id], _FindLeaderboard(@:privateAccess id.toUtf8())))
-					processNextLeaderboardOp();
-			case UPLOAD(score):
-				if (!report("Leaderboard.UPLOAD", [score.toString()], _UploadScore(@:privateAccess score.leaderboardId.toUtf8(), score.score, score.detail)))
-					processNextLeaderboardOp();
-			case DOWNLOAD(id):
-				if (!report("Leaderboard.DOWNLOAD", [id], _DownloadScores(@:privateAccess id.toUtf8(), 0, 0)))
-					processNextLeaderboardOp();
-		}
-	}
-
 	private static function report(func:String, params:Array<String>, result:Bool):Bool {
 		var str = "[STEAM] " + func + "(" + params.join(",") + ") " + (result ? " SUCCEEDED" : " FAILED");
 		customTrace(str);
@@ -462,8 +630,7 @@ class Api
 				haveReceivedUserStats = success;
 
 			case UserStatsStored:
-				// retry next frame if failed
-				wantStoreStats = !success;
+				// failed stores are retried natively
 
 			case UserAchievementStored:
 				if (whenAchievementStored != null) whenAchievementStored(data);
@@ -481,33 +648,26 @@ class Api
 			case GlobalStatsReceived:
 				haveGlobalStats = success;
 
-			case LeaderboardFound:
-				if (success) {
-					leaderboardIds.push(data);
-				}
-				processNextLeaderboardOp();
-			case ScoreDownloaded:
-				if (success) {
-					var scores = data.split(";");
-					for (score in scores) {
-						var score = LeaderboardScore.fromString(data);
-						if (score != null && whenLeaderboardScoreDownloaded != null) whenLeaderboardScoreDownloaded(score);
-					}
-				}
-				processNextLeaderboardOp();
-			case ScoreUploaded:
-				if (success) {
-					var score = LeaderboardScore.fromString(data);
-					if (score != null && whenLeaderboardScoreUploaded != null) whenLeaderboardScoreUploaded(score);
-				}
-				processNextLeaderboardOp();
 			case None:
+			default:
 		}
 	}
 
 	@:hlNative("steam","init") private static function _Init( onEvent : EventType -> Bool -> hl.Bytes -> Void, onGlobalEvent : Int -> Dynamic -> Void ) : Bool { return false; }
+	@:hlNative("steam","register_typed_event") private static function _RegisterTypedEvent( event : Int, obj : Event, callb : Event -> Void ) : Void {};
+	@:hlNative("steam","subscribe_event") private static function _SubscribeEvent( event : Int, b : Bool ) : Void {};
+	@:hlNative("steam","set_profiling") private static function _SetProfiling( b : Bool ) : Void {};
+	@:hlNative("steam","read_callback_stats") private static function _ReadCallbackStats( buffer : hl.Bytes, maxCallbacks : Int ) : Int { return 0; }
+	@:hlNative("steam","reset_callback_stats") private static function _ResetCallbackStats() : Void {};
+	@:hlNative("steam","set_event_queue") private static function _SetEventQueue( b : Bool ) : Void {};
+	@:hlNative("steam","set_event_priority") private static function _SetEventPriority( event : Int, low : Bool ) : Void {};
+	@:hlNative("steam","dispatch_events") private static function _DispatchEvents( maxLow : Int ) : Int { return 0; }
+	@:hlNative("steam","get_queued_events") private static function _GetQueuedEvents() : Int { return 0; }
+	@:hlNative("steam","get_dropped_events") private static function _GetDroppedEvents() : Int { return 0; }
 	@:hlNative("steam","shutdown") private static function _Shutdown(): Void{};
 	@:hlNative("steam","run_callbacks") private static function _RunCallbacks(): Void{};
+	@:hlNative("steam","init_manual_dispatch") private static function _InitManualDispatch() : Bool { return false; }
+	@:hlNative("steam","run_manual_callbacks") private static function _RunManualCallbacks( budget : Int ) : Int { return 0; }
 	@:hlNative("steam","request_stats") private static function _RequestStats() : Bool { return false; }
 	@:hlNative("steam","get_stat_float") private static function _GetStatFloat( name : hl.Bytes ) : Float { return 0.; }
 	@:hlNative("steam","get_stat_int") private static function _GetStatInt( name : hl.Bytes ) : Int { return 0; }
@@ -521,11 +681,14 @@ class Api
 	@:hlNative("steam","clear_achievement") private static function _ClearAchievement( name : hl.Bytes ) : Bool { return false; }
 	@:hlNative("steam","indicate_achievement_progress") private static function _IndicateAchievementProgress( name : hl.Bytes, curProgress : Int, maxProgress : Int ) : Bool { return false; }
 	@:hlNative("steam","store_stats") private static function _StoreStats() : Bool { return false; }
-	@:hlNative("steam","find_leaderboard") private static function _FindLeaderboard( name : hl.Bytes ) : Bool { return false; }
-	@:hlNative("steam","upload_score") private static function _UploadScore( name : hl.Bytes, score : Int, detail : Int ) : Bool { return false; }
-	@:hlNative("steam","download_scores") private static function _DownloadScores( name : hl.Bytes, before: Int, afeter : Int ) : Bool { return false; }
-	@:hlNative("steam","request_global_stats") private static function _RequestGlobalStats() : Bool { return false; }
-	@:hlNative("steam","get_global_stat") private static function _GetGlobalStat( name : hl.Bytes ) : Int { return 0; }
+	@:hlNative("steam","set_stats_store_interval") private static function _SetStatsStoreInterval( seconds : Float ) : Void {};
+	@:hlNative("steam","get_pending_stats") private static function _GetPendingStats( achievements : hl.Ref<Int>, storing : hl.Ref<Int> ) : Int { return 0; }
+	@:hlNative("steam","open_stats_shadow") private static function _OpenStatsShadow( path : hl.Bytes ) : Bool { return false; }
+	@:hlNative("steam","close_stats_shadow") private static function _CloseStatsShadow() : Void {};
+	@:hlNative("steam","get_unsynced_stats") private static function _GetUnsyncedStats() : Int { return 0; }
+	@:hlNative("steam","request_global_stats") private static function _RequestGlobalStats( historyDays : Int ) : Bool { return false; }
+	@:hlNative("steam","get_global_stat") private static function _GetGlobalStat( name : hl.Bytes, high : hl.Ref<Int> ) : Int { return 0; }
+	@:hlNative("steam","get_global_stat_float") private static function _GetGlobalStatFloat( name : hl.Bytes ) : Float { return 0.; }
 	@:hlNative("steam","restart_app_if_necessary") private static function _RestartAppIfNecessary( appId : Int ) : Bool { return false; }
 	@:hlNative("steam","is_overlay_enabled") private static function _IsOverlayEnabled() : Bool { return false; }
 	@:hlNative("steam","boverlay_needs_present") private static function _BOverlayNeedsPresent() : Bool { return false; }
@@ -547,11 +710,22 @@ class LeaderboardScore {
 	public var detail:Int;
 	public var rank:Int;
 
+	/**
+		The owner of the entry, null for the scores built locally.
+	**/
+	public var user:User;
+
+	/**
+		All the details of the entry, `detail` being the first one (or -1).
+	**/
+	public var details:Array<Int>;
+
 	public function new(leaderboardId_:String, score_:Int, detail_:Int, rank_:Int=-1) {
 		leaderboardId = leaderboardId_;
 		score = score_;
 		detail = detail_;
 		rank = rank_;
+		details = detail_ == -1 ? [] : [detail_];
 	}
 
 	public function toString():String {
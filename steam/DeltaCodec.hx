@@ -0,0 +1,81 @@
+package steam;
+
+private typedef CodecData = hl.Abstract<"steam_delta_codec">;
+
+/**
+	Encodes replicated state as a delta against the last snapshot each peer acknowledged.
+	The receiver must send back the sequence of each snapshot it decodes (see `getSequence`)
+	and the sender report it with `ack`, until then states are encoded against an older baseline.
+**/
+@:hlNative("steam")
+class DeltaCodec {
+
+	var codec : CodecData;
+	public var maxStateSize(default,null) : Int;
+
+	/**
+		@param maxStateSize the largest state that can be encoded
+		@param history the number of snapshots kept per peer (up to 128), a baseline older than that is no longer used
+	**/
+	public function new( maxStateSize : Int, history = 32 ) {
+		codec = delta_codec_alloc(maxStateSize, history);
+		if( codec == null ) throw "Invalid delta codec parameters";
+		this.maxStateSize = maxStateSize;
+	}
+
+	/**
+		Size of the `out` buffer needed to encode a state of `size` bytes in the worst case.
+	**/
+	public static inline function getMaxEncodedSize( size : Int ) {
+		return size + 18;
+	}
+
+	/**
+		Sequence of an encoded snapshot, to acknowledge once it has been decoded.
+	**/
+	public static inline function getSequence( data : hl.Bytes ) {
+		return data.getUI16(0);
+	}
+
+	/**
+		Encode the `size` first bytes of `state` for `user`, returns the encoded size or -1 if `out` is too small.
+	**/
+	public function encode( user : User, state : hl.Bytes, size : Int, out : hl.Bytes, outSize : Int ) : Int {
+		return delta_encode(codec, user.uid, state, size, out, outSize);
+	}
+
+	public function ack( user : User, sequence : Int ) : Bool {
+		return delta_ack(codec, user.uid, sequence);
+	}
+
+	/**
+		Decode a snapshot received from `user` into `out`, returns the state size,
+		or -1 if its baseline is no longer known (the sender should then be told to reset).
+	**/
+	public function decode( user : User, data : hl.Bytes, len : Int, out : hl.Bytes, outSize : Int ) : Int {
+		return delta_decode(codec, user.uid, data, len, out, outSize);
+	}
+
+	/**
+		Forget the snapshots exchanged with `user`, for instance when its session is closed.
+	**/
+	public function reset( user : User ) {
+		delta_codec_reset(codec, user.uid);
+	}
+
+	public function dispose() {
+		if( codec == null ) return;
+		delta_codec_free(codec);
+		codec = null;
+	}
+
+	// -- native
+
+	static function delta_codec_alloc( stateSize : Int, history : Int ) : CodecData { return null; }
+	static function delta_codec_free( codec : CodecData ) : Void {}
+	static function delta_codec_reset( codec : CodecData, uid : UID ) : Void {}
+	static function delta_encode( codec : CodecData, uid : UID, state : hl.Bytes, size : Int, out : hl.Bytes, outSize : Int ) : Int { return -1; }
+	static function delta_ack( codec : CodecData, uid : UID, sequence : Int ) : Bool { return false; }
+	static function delta_decode( codec : CodecData, uid : UID, data : hl.Bytes, len : Int, out : hl.Bytes, outSize : Int ) : Int { return -1; }
+
+}
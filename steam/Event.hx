@@ -0,0 +1,95 @@
+package steam;
+
+/**
+	Base of the typed events, see `Api.registerTypedEvent`. The native side writes each event
+	into the same instance, UIDs included : `copy()` the ones you keep after the handler returns.
+	Fields are declared in the order of the native structures and must not be reordered.
+**/
+class Event {
+	public var id(default, null) : Int = 0;
+	public function new() {}
+}
+
+// common
+
+class PersonaChangeEvent extends Event {
+	public var user : UID = UID.alloc();
+	public var flags : haxe.EnumFlags<User.Changed> = new haxe.EnumFlags();
+}
+
+class OverlayActivatedEvent extends Event {
+	public var active : Bool = false;
+}
+
+class AuthTicketEvent extends Event {
+	public var authTicket : Int = 0;
+	public var result : Int = 0;
+}
+
+// matchmaking
+
+class LobbyDataEvent extends Event {
+	public var lobby : UID = UID.alloc();
+	/** same as `lobby` when the lobby data itself changed **/
+	public var user : UID = UID.alloc();
+	public var success : Bool = false;
+}
+
+class LobbyChatUpdateEvent extends Event {
+	public var lobby : UID = UID.alloc();
+	public var user : UID = UID.alloc();
+	public var origin : UID = UID.alloc();
+	public var flags : Int = 0;
+}
+
+class LobbyChatMsgEvent extends Event {
+	public var lobby : UID = UID.alloc();
+	public var user : UID = UID.alloc();
+	public var type : Lobby.ChatMessageType = Lobby.ChatMessageType.Invalid;
+	public var cid : Int = 0;
+}
+
+class LobbyJoinRequestEvent extends Event {
+	public var lobby : UID = UID.alloc();
+	public var user : UID = UID.alloc();
+}
+
+// networking, also sent to the game server
+
+class SessionRequestEvent extends Event {
+	public var uid : UID = UID.alloc();
+}
+
+class SessionFailedEvent extends Event {
+	public var uid : UID = UID.alloc();
+	public var error : Networking.NetworkStatus = Networking.NetworkStatus.None;
+	/** the connection end reason, messages sessions only **/
+	public var reason : Int = 0;
+}
+
+// ugc
+
+class ItemEvent extends Event {
+	public var file : UID = UID.alloc();
+}
+
+// game server
+
+class ServerConnectFailureEvent extends Event {
+	public var result : Int = 0;
+	public var stillRetrying : Bool = false;
+}
+
+class ServerResultEvent extends Event {
+	public var result : Int = 0;
+}
+
+class PolicyResponseEvent extends Event {
+	public var secure : Bool = false;
+}
+
+class ValidateAuthTicketEvent extends Event {
+	public var steamId : UID = UID.alloc();
+	public var ownerSteamId : UID = UID.alloc();
+	public var authSessionResponse : Int = 0;
+}
@@ -81,7 +81,7 @@ class Friends {
 
 	public static function getFriends( ?flags : FriendFlags ) {
 		if( flags == null ) flags = Immediate;
-		return [for( uid in get_friends(flags) ) User.fromUID(uid)];
+		return @:privateAccess User.readIds(get_friend_ids.bind(flags));
 	}
 
 	public static function hasFriend( user : User, ?flags : FriendFlags ) {
@@ -96,6 +96,7 @@ class Friends {
 	public static function activateOverlayStore( appId : Int, flags : OverlayToStoreFlag ) : Void {}
 
 	static function get_friends( flags : FriendFlags ) : hl.NativeArray<UID> { return null; }
+	static function get_friend_ids( flags : FriendFlags, out : hl.Bytes, max : Int ) : Int { return 0; }
 	static function has_friend( uid : UID, flags : FriendFlags ) : Bool { return false; }
 	static function activate_overlay_user( overlay : hl.Bytes, uid : UID ) : Void {}
 
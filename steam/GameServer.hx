@@ -14,6 +14,15 @@ class GameServer {
 
 	@:noComplete public static function registerGlobalEvent( event : Int, callb : Dynamic -> Void ) {
 		globalEvents.set(event, callb);
+		gameserver_subscribe_event(event, callb != null);
+	}
+
+	/**
+		Same as `Api.registerTypedEvent` for the server events. Events with no server handler
+		use the `Api` one, typed or not.
+	**/
+	@:noComplete public static function registerTypedEvent<T:Event>( event : Int, obj : T, callb : T -> Void ) {
+		gameserver_register_typed_event(event, obj, cast callb);
 	}
 
 	public static function init( ip : sys.net.Host, port : Int, gameport : Int, queryPort : Int, serverMode : ServerMode, version : String ) {
@@ -67,22 +76,22 @@ class GameServer {
 
 		var ucb = 100;
 		//SteamServersConnected_t
-		registerGlobalEvent(ucb + 1, function(_:Dynamic) {
+		registerTypedEvent(ucb + 1, new Event(), function(_) {
 			if( onLogin == null ) return;
-			registerGlobalEvent(ucb + 3, onDisconnected);
+			registerTypedEvent(ucb + 3, new Event.ServerResultEvent(), onDisconnected);
 			onLogin(true);
 			onLogin = null;
 		});
 		//SteamServerConnectFailure_t
-		registerGlobalEvent(ucb + 2, function(r:Dynamic) { if( onLogin == null ) return; customTrace("CONNECT FAILURE " + r); onLogin(false); onLogin = null; });
+		registerTypedEvent(ucb + 2, new Event.ServerConnectFailureEvent(), function(r) { if( onLogin == null ) return; customTrace("CONNECT FAILURE " + r.result); onLogin(false); onLogin = null; });
 		//SteamServersDisconnected_t
-		registerGlobalEvent(ucb + 3, function(r:Dynamic) { if( onLogin == null ) return; customTrace("CONNECT FAILURE " + r); onLogin(false); onLogin = null; });
-		registerGlobalEvent(ucb + 15, function(_:Dynamic) { /* ignore VAC flag */ });
+		registerTypedEvent(ucb + 3, new Event.ServerResultEvent(), function(r) { if( onLogin == null ) return; customTrace("CONNECT FAILURE " + r.result); onLogin(false); onLogin = null; });
+		registerTypedEvent(ucb + 15, new Event.PolicyResponseEvent(), function(_) { /* ignore VAC flag */ });
 
 		gameserver_logon_anonymous();
 	}
 
-	static function onDisconnected(_:Dynamic) {
+	static function onDisconnected(_:Event.ServerResultEvent) {
 		customTrace("Gameserver disconnected, retrying...");
 		logonAnonymous(function(b) {
 			if( b ) {
@@ -98,8 +107,27 @@ class GameServer {
 	public static function shutdown() {
 	}
 
+	static var manualDispatch = false;
+
+	/**
+		Time in microseconds each server frame can spend running callbacks once manual dispatch is enabled, 0 for no limit.
+	**/
+	public static var callbackBudget = 0;
+	public static var queuedCallbacks(default, null) = 0;
+
+	/**
+		Same as `Api.enableManualDispatch`, to call right after `init`.
+	**/
+	public static function enableManualDispatch() : Bool {
+		manualDispatch = gameserver_init_manual_dispatch();
+		return manualDispatch;
+	}
+
 	static function runGameServer() {
-		gameserver_runcallbacks();
+		if( manualDispatch )
+			queuedCallbacks = gameserver_run_manual_callbacks(callbackBudget);
+		else
+			gameserver_runcallbacks();
 	}
 
 	static function gameserver_init( ip : Int, port : Int, gameport : Int, queryport : Int, serverMode : ServerMode, version : hl.Bytes ) : Bool {
@@ -109,12 +137,26 @@ class GameServer {
 	static function gameserver_runcallbacks() {
 	}
 
+	static function gameserver_init_manual_dispatch() : Bool {
+		return false;
+	}
+
+	static function gameserver_run_manual_callbacks( budget : Int ) : Int {
+		return 0;
+	}
+
 	static function gameserver_logon_anonymous() {
 	}
 
 	static function gameserver_setup( onGlobalEvent : Int -> Dynamic -> Void ) {
 	}
 
+	static function gameserver_register_typed_event( event : Int, obj : Event, callb : Event -> Void ) {
+	}
+
+	static function gameserver_subscribe_event( event : Int, b : Bool ) {
+	}
+
 	static function gameserver_config( modDir : hl.Bytes, name : hl.Bytes, desc : hl.Bytes ) {
 	}
 
@@ -0,0 +1,89 @@
+package steam;
+
+/**
+	A list of global stats read all together in a single native call, with up to `days` days of daily history
+	(requested with `Api.requestGlobalStats`). Int stats are read as 64 bits values.
+	The result only changes when new global stats are received, `update` does nothing until then.
+**/
+@:hlNative("steam")
+class GlobalStats {
+
+	public var names(default,null) : Array<String>;
+	public var isFloat(default,null) : Bool;
+	public var days(default,null) : Int;
+	/**
+		The number of stats available after the last `update`.
+	**/
+	public var count(default,null) = 0;
+
+	var nameBytes : haxe.io.Bytes;
+	var values : hl.Bytes;
+	var available : hl.BytesAccess<Int>;
+	var generation = -1;
+
+	public function new( names : Array<String>, isFloat = false, days = 0 ) {
+		this.names = names;
+		this.isFloat = isFloat;
+		this.days = days < 0 ? 0 : days;
+		var b = new haxe.io.BytesBuffer();
+		for( n in names ) {
+			b.addString(n);
+			b.addByte(0);
+		}
+		nameBytes = b.getBytes();
+		values = new hl.Bytes(names.length * (this.days + 1) << 3);
+		available = new hl.Bytes(names.length << 2);
+	}
+
+	/**
+		Read the stats again if new global stats were received since, returns true if it did.
+	**/
+	public function update() : Bool {
+		var g = get_global_stats_generation();
+		if( g == generation ) return false;
+		count = get_global_stats(@:privateAccess nameBytes.b, names.length, isFloat, days, values, available);
+		// not received yet : read again on the next update
+		if( count > 0 ) generation = g;
+		return true;
+	}
+
+	public inline function isAvailable( stat : Int ) : Bool {
+		return available[stat] >= 0;
+	}
+
+	/**
+		The number of history days available for this stat.
+	**/
+	public inline function getDays( stat : Int ) : Int {
+		return available[stat] < 0 ? 0 : available[stat];
+	}
+
+	/**
+		The total of the stat, or its value `day` days ago if set (0 being the most recent day).
+	**/
+	public function get( stat : Int, ?day : Int ) : Float {
+		var pos = position(stat, day);
+		if( isFloat ) return values.getF64(pos);
+		var low : Float = values.getI32(pos);
+		if( low < 0 ) low += 4294967296.;
+		return values.getI32(pos + 4) * 4294967296. + low;
+	}
+
+	/**
+		The exact value of an int stat, see `get`.
+	**/
+	public function getInt64( stat : Int, ?day : Int ) : haxe.Int64 {
+		var pos = position(stat, day);
+		return haxe.Int64.make(values.getI32(pos + 4), values.getI32(pos));
+	}
+
+	inline function position( stat : Int, day : Null<Int> ) {
+		return (stat * (days + 1) + (day == null ? 0 : day + 1)) << 3;
+	}
+
+	// -- native
+
+	static function get_global_stats( names : hl.Bytes, count : Int, isFloat : Bool, days : Int, values : hl.Bytes, available : hl.Bytes ) : Int { return 0; }
+	static function get_global_stats_generation() : Int { return 0; }
+
+}
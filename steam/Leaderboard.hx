@@ -0,0 +1,396 @@
+package steam;
+
+import steam.Api.LeaderboardScore;
+
+@:enum abstract LeaderboardUploadMethod(Int) {
+	/**
+		The score is only replaced if the new one is better
+	**/
+	var KeepBest = 1;
+	var ForceUpdate = 2;
+}
+
+@:enum abstract LeaderboardRequest(Int) {
+	/**
+		Ranks [start, end], starting at 1
+	**/
+	var Global = 0;
+	/**
+		Ranks relative to the user, [start, end] being offsets such as [-4, 5]
+	**/
+	var AroundUser = 1;
+	/**
+		The user and its friends, start and end are ignored
+	**/
+	var Friends = 2;
+}
+
+/**
+	Downloaded entries, decoded natively as arrays : 64 bits steam ids, then ranks, scores,
+	the position of the details of each entry (plus the end of the last one) and all the details.
+**/
+class LeaderboardEntries {
+
+	public var leaderboard(default,null) : Leaderboard;
+	public var length(default,null) : Int;
+	public var ranks(default,null) : hl.BytesAccess<Int>;
+	public var scores(default,null) : hl.BytesAccess<Int>;
+	var data : hl.Bytes;
+	var details : hl.BytesAccess<Int>;
+
+	function new( leaderboard, data : hl.Bytes, length : Int ) {
+		this.leaderboard = leaderboard;
+		this.data = data;
+		this.length = length;
+		ranks = data.offset(length * 8);
+		scores = data.offset(length * 12);
+		details = data.offset(length * 16);
+	}
+
+	public inline function getRank( i : Int ) {
+		return ranks[i];
+	}
+
+	public inline function getScore( i : Int ) {
+		return scores[i];
+	}
+
+	public function getUser( i : Int ) : User {
+		return User.fromEventUID(cast data.offset(i * 8));
+	}
+
+	public inline function getDetailsCount( i : Int ) {
+		return details[i + 1] - details[i];
+	}
+
+	public inline function getDetail( i : Int, k : Int ) {
+		return details[length + 1 + details[i] + k];
+	}
+
+	/**
+		The entry as a `LeaderboardScore`, which is allocated.
+	**/
+	public function toScore( i : Int ) : LeaderboardScore {
+		var count = getDetailsCount(i);
+		var s = new LeaderboardScore(leaderboard.name, getScore(i), count > 0 ? getDetail(i, 0) : -1, getRank(i));
+		s.user = getUser(i);
+		s.details = [for( k in 0...count ) getDetail(i, k)];
+		return s;
+	}
+
+}
+
+/**
+	Streams a ranked range page by page : each page that is read makes the next one prefetched, so that
+	scrolling through thousands of entries only waits for the first page. Pages far from the last one read are released.
+**/
+class LeaderboardPager {
+
+	public var leaderboard(default,null) : Leaderboard;
+	public var request(default,null) : LeaderboardRequest;
+	public var pageSize(default,null) : Int;
+	var first : Int;
+	var pages : Map<Int, LeaderboardEntries>;
+	var pending : Map<Int, Array<LeaderboardEntries -> Void>>;
+	var calls : Map<Int, AsyncCall>;
+	var keepPages : Int;
+	var disposed = false;
+
+	/**
+		@param request Global or AroundUser, Friends has no range
+		@param first the first rank (Global) or offset to the user (AroundUser) of page 0
+		@param keepPages the number of pages kept around the last one read
+	**/
+	public function new( leaderboard : Leaderboard, request : LeaderboardRequest, pageSize = 100, ?first : Int, keepPages = 8 ) {
+		this.leaderboard = leaderboard;
+		this.request = request;
+		this.pageSize = pageSize;
+		this.first = first == null ? (request == Global ? 1 : 0) : first;
+		this.keepPages = keepPages;
+		pages = new Map();
+		pending = new Map();
+		calls = new Map();
+	}
+
+	/**
+		The page if it is already downloaded, or null.
+	**/
+	public function getPage( page : Int ) : LeaderboardEntries {
+		return pages.get(page);
+	}
+
+	/**
+		Get a page (immediately if it is already downloaded) and prefetch the next one.
+		`onResult` receives null on failure, and an empty page past the end of the leaderboard.
+	**/
+	public function load( page : Int, onResult : LeaderboardEntries -> Void ) {
+		var p = pages.get(page);
+		if( p != null )
+			onResult(p);
+		else
+			fetch(page, onResult);
+		if( !isLast(page) )
+			fetch(page + 1, null);
+		release(page);
+	}
+
+	/**
+		Cancel the pending downloads, the pager can no longer be used.
+	**/
+	public function dispose() {
+		disposed = true;
+		for( c in calls ) c.cancel();
+		pages = new Map();
+		pending = new Map();
+		calls = new Map();
+	}
+
+	function isLast( page : Int ) {
+		var p = pages.get(page);
+		if( p != null && p.length < pageSize ) return true;
+		// the entry count is known once a download completed
+		return request == Global && leaderboard.getEntryCount() > 0 && first + (page + 1) * pageSize > leaderboard.getEntryCount();
+	}
+
+	function fetch( page : Int, onResult : LeaderboardEntries -> Void ) {
+		if( disposed ) {
+			if( onResult != null ) onResult(null);
+			return;
+		}
+		if( pages.exists(page) ) return;
+		var wait = pending.get(page);
+		if( wait != null ) {
+			if( onResult != null ) wait.push(onResult);
+			return;
+		}
+		pending.set(page, onResult == null ? [] : [onResult]);
+		var start = first + page * pageSize;
+		leaderboard.download(request, start, start + pageSize - 1, function(entries) {
+			if( disposed ) return;
+			var wait = pending.get(page);
+			pending.remove(page);
+			calls.remove(page);
+			if( entries != null ) pages.set(page, entries);
+			for( f in wait ) f(entries);
+		}, function(call) {
+			// issued once the board is resolved, which might be after the dispose
+			if( disposed )
+				call.cancel();
+			else if( pending.exists(page) )
+				calls.set(page, call);
+		});
+	}
+
+	function release( page : Int ) {
+		for( p in [for( p in pages.keys() ) p] )
+			if( p < page - keepPages || p > page + keepPages )
+				pages.remove(p);
+	}
+
+}
+
+/**
+	A leaderboard, registered once by name with `Leaderboard.get` and then designated natively by its `id`.
+	Requests don't wait for each other : any number of finds, uploads and downloads can be pending at once,
+	each one reporting to its own callback. Requests made before the board is resolved wait for it and return null :
+	their call is given to `onCall` once issued, so that they can still be cancelled.
+**/
+@:hlNative("steam")
+class Leaderboard {
+
+	/**
+		File keeping the board handles between launches, so that a warm start can post scores
+		before any round-trip (the handles are still verified in the background). Null to disable it.
+	**/
+	public static var cacheFile : String = null;
+	static var boards = new Map<String, Leaderboard>();
+
+	public var name(default,null) : String;
+	public var id(default,null) : Int;
+	public var resolved(get,never) : Bool;
+	var waiting : Array<Bool -> Void>;
+
+	function new(name) {
+		this.name = name;
+		id = register_leaderboard(@:privateAccess name.toUtf8());
+	}
+
+	function get_resolved() {
+		return get_leaderboard_handle(id) != null;
+	}
+
+	/**
+		The number of entries in the leaderboard, once it has been downloaded at least once.
+	**/
+	public function getEntryCount() : Int {
+		return get_leaderboard_entry_count(id);
+	}
+
+	/**
+		Call `onResult` once the board is found, immediately if it is already known.
+	**/
+	public function resolve( onResult : Bool -> Void ) {
+		if( resolved )
+			onResult(true);
+		else
+			refresh(onResult);
+	}
+
+	/**
+		Find the board again, requests for the same board share a single find.
+	**/
+	function refresh( ?onResult : Bool -> Void ) {
+		if( waiting != null ) {
+			if( onResult != null ) waiting.push(onResult);
+			return;
+		}
+		var before = handleString();
+		waiting = onResult == null ? [] : [onResult];
+		var call = find_leaderboard(id, function(found, error) {
+			// a cached handle is only dropped if the board no longer exists
+			if( !found && !error ) set_leaderboard_handle(id, null);
+			var w = waiting;
+			waiting = null;
+			if( handleString() != before ) saveCache();
+			for( f in w ) f(found);
+		});
+		if( call == null ) {
+			var w = waiting;
+			waiting = null;
+			for( f in w ) f(false);
+		}
+	}
+
+	function request( onFail : Void -> Void, call : Void -> AsyncCall, onCall : AsyncCall -> Void ) : AsyncCall {
+		if( !resolved ) {
+			resolve(function(ok) {
+				var c = ok ? call() : null;
+				if( c == null ) onFail() else if( onCall != null ) onCall(c);
+			});
+			return null;
+		}
+		var c = call();
+		if( c == null ) onFail() else if( onCall != null ) onCall(c);
+		return c;
+	}
+
+	function handleString() {
+		var h = get_leaderboard_handle(id);
+		return h == null ? null : h.getBytes().toHex();
+	}
+
+	/**
+		Upload a score with up to 64 details, `onResult` receives the score with its new rank, or null on failure.
+	**/
+	public function upload( score : Int, ?details : Array<Int>, method = KeepBest, ?onResult : LeaderboardScore -> Void, ?onCall : AsyncCall -> Void ) : AsyncCall {
+		var count = details == null ? 0 : details.length;
+		var bytes = new hl.Bytes(count * 4 + 1);
+		for( i in 0...count )
+			bytes.setI32(i << 2, details[i]);
+		function onFail() if( onResult != null ) onResult(null);
+		return request(onFail, function() return upload_leaderboard_score(id, method, score, bytes, count, function(success, score, rank, previousRank, changed) {
+			if( !success ) {
+				onFail();
+				return;
+			}
+			if( onResult == null ) return;
+			var s = new LeaderboardScore(name, score, count > 0 ? details[0] : -1, rank);
+			s.user = Api.getUser();
+			if( count > 0 ) s.details = details.copy();
+			onResult(s);
+		}), onCall);
+	}
+
+	/**
+		Download a range of entries, with all their details. `onResult` receives null on failure.
+		See `LeaderboardPager` to go through a large range.
+	**/
+	public function download( request : LeaderboardRequest, start : Int, end : Int, onResult : LeaderboardEntries -> Void, ?onCall : AsyncCall -> Void ) : AsyncCall {
+		return this.request(onResult.bind(null), function() return download_leaderboard_entries(id, request, start, end, onEntries.bind(onResult)), onCall);
+	}
+
+	/**
+		Download the entries of up to 100 users, the ones without an entry being skipped.
+	**/
+	public function downloadUsers( users : Array<User>, onResult : LeaderboardEntries -> Void, ?onCall : AsyncCall -> Void ) : AsyncCall {
+		var ids = new hl.Bytes(users.length * 8 + 1);
+		for( i in 0...users.length )
+			ids.blit(i * 8, cast users[i].uid, 0, 8);
+		return request(onResult.bind(null), function() return download_leaderboard_users(id, ids, users.length, onEntries.bind(onResult)), onCall);
+	}
+
+	function onEntries( onResult : LeaderboardEntries -> Void, entries : hl.Bytes, count : Int, error : Bool ) {
+		onResult(error ? null : @:privateAccess new LeaderboardEntries(this, entries, count));
+	}
+
+	/**
+		The board registered under `name`, which might not be resolved yet.
+	**/
+	public static function get( name : String ) : Leaderboard {
+		var b = boards.get(name);
+		if( b == null ) {
+			b = new Leaderboard(name);
+			boards.set(name, b);
+		}
+		return b;
+	}
+
+	/**
+		Resolve a leaderboard by name, `onResult` receives null if it does not exist.
+	**/
+	public static function find( name : String, onResult : Leaderboard -> Void ) {
+		var b = get(name);
+		b.resolve(function(found) onResult(found ? b : null));
+	}
+
+	/**
+		Register the boards and find all of them at once. The handles kept in `cacheFile` are usable immediately.
+	**/
+	public static function init( names : Array<String> ) {
+		var cache = loadCache();
+		for( name in names ) {
+			var b = get(name);
+			var h = cache.get(name);
+			if( h != null ) set_leaderboard_handle(b.id, h);
+			b.refresh();
+		}
+	}
+
+	// one "handle name" line per board
+	static function loadCache() : Map<String, UID> {
+		var cache = new Map();
+		if( cacheFile == null || !sys.FileSystem.exists(cacheFile) )
+			return cache;
+		try {
+			for( line in StringTools.replace(sys.io.File.getContent(cacheFile), "\r", "").split("\n") ) {
+				var sep = line.indexOf(" ");
+				if( sep == 16 )
+					cache.set(line.substr(sep + 1), UID.fromBytes(haxe.io.Bytes.ofHex(line.substr(0, sep))));
+			}
+		} catch( e : Dynamic ) {
+		}
+		return cache;
+	}
+
+	static function saveCache() {
+		if( cacheFile == null ) return;
+		var lines = [];
+		for( b in boards ) {
+			var h = b.handleString();
+			if( h != null ) lines.push(h + " " + b.name);
+		}
+		try sys.io.File.saveContent(cacheFile, lines.join("\n")) catch( e : Dynamic ) {}
+	}
+
+	// -- native
+
+	static function register_leaderboard( name : hl.Bytes ) : Int { return -1; }
+	static function get_leaderboard_handle( board : Int ) : UID { return null; }
+	static function set_leaderboard_handle( board : Int, handle : UID ) : Void {}
+	static function find_leaderboard( board : Int, onResult : Bool -> Bool -> Void ) : AsyncCall { return null; }
+	static function upload_leaderboard_score( board : Int, method : LeaderboardUploadMethod, score : Int, details : hl.Bytes, count : Int, onResult : Bool -> Int -> Int -> Int -> Bool -> Void ) : AsyncCall { return null; }
+	static function download_leaderboard_entries( board : Int, request : LeaderboardRequest, start : Int, end : Int, onResult : hl.Bytes -> Int -> Bool -> Void ) : AsyncCall { return null; }
+	static function download_leaderboard_users( board : Int, users : hl.Bytes, count : Int, onResult : hl.Bytes -> Int -> Bool -> Void ) : AsyncCall { return null; }
+	static function get_leaderboard_entry_count( board : Int ) : Int { return 0; }
+
+}
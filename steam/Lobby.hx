@@ -92,7 +92,7 @@ class Lobby {
 	}
 
 	function get_owner() {
-		return User.fromUID(get_lobby_owner(uid));
+		return User.fromId(get_lobby_owner_id(uid));
 	}
 
 	public function join( onJoin : { inviteOnly : Bool } -> Void ) {
@@ -100,7 +100,7 @@ class Lobby {
 	}
 
 	public function getMembers() {
-		return [for( i in 0...get_num_lobby_members(uid) ) User.fromUID(get_lobby_member_by_index(uid, i))];
+		return @:privateAccess User.readIds(get_lobby_member_ids.bind(uid));
 	}
 
 	public function getMemberData( user : User, key : String ) : String {
@@ -214,6 +214,14 @@ class Lobby {
 		return 0;
 	}
 
+	static function get_lobby_member_ids( uid : UID, out : hl.Bytes, max : Int ) : Int {
+		return 0;
+	}
+
+	static function get_lobby_owner_id( uid : UID ) : Int {
+		return 0;
+	}
+
 	static function get_lobby_member_by_index( uid : UID, index : Int ) : UID {
 		return null;
 	}
@@ -1,4 +1,5 @@
 package steam;
+import steam.Event;
 
 @:enum abstract LobbyKind(Int) {
 	/**
@@ -62,42 +63,43 @@ class Matchmaking {
 		var fid = 300;
 
 		// LobbyDataUpdate_t
-		Api.registerGlobalEvent(eid + 5, function(data:{lobby:UID, user:Null<UID>}) {
-			if( data == null ) {
+		Api.registerTypedEvent(eid + 5, new LobbyDataEvent(), function(data) {
+			if( !data.success ) {
 				Api.customTrace("Failed to retreive data");
 				return;
 			}
 			var l = getLobby(data.lobby);
 			if( l == null ) return;
-			if( data.user != null )
-				l.onUserDataUpdated(User.fromUID(data.user));
+			if( data.user != data.lobby )
+				l.onUserDataUpdated(User.fromEventUID(data.user));
 			else
 				l.onDataUpdated();
 		});
 
 		// LobbyChatUpdate_t
-		Api.registerGlobalEvent(eid + 6, function(data:{lobby:UID, user:UID, origin:UID, flags:haxe.EnumFlags<LobbyChatFlag>}) {
+		Api.registerTypedEvent(eid + 6, new LobbyChatUpdateEvent(), function(data) {
 			var l = getLobby(data.lobby);
 			if( l == null ) return;
-			if( data.flags.has(Entered) )
-				l.onUserJoined(User.fromUID(data.user));
+			var flags = new haxe.EnumFlags<LobbyChatFlag>(data.flags);
+			if( flags.has(Entered) )
+				l.onUserJoined(User.fromEventUID(data.user));
 			else
-				l.onUserLeft(User.fromUID(data.user)); // no need for reason for now
+				l.onUserLeft(User.fromEventUID(data.user)); // no need for reason for now
 		});
 
 		// LobbyChatMsg_t
-		Api.registerGlobalEvent(eid + 7, function(data:{lobby:UID, user:UID, type:Lobby.ChatMessageType, cid:Int}) {
+		Api.registerTypedEvent(eid + 7, new LobbyChatMsgEvent(), function(data) {
 			var l = getLobby(data.lobby);
 			if( l == null ) return;
 			l.onChatMessage(data.type, data.cid);
 		});
 
 		// GameLobbyJoinRequested_t
-		Api.registerGlobalEvent(fid + 33, function(data:{user:UID, lobby:UID}) {
+		Api.registerTypedEvent(fid + 33, new LobbyJoinRequestEvent(), function(data) {
 			var l = lobbies.get(data.lobby.toString());
 			if( l == null )
-				l = new Lobby(data.lobby);
-			onInvited(l, User.fromUID(data.user));
+				l = new Lobby(data.lobby.copy());
+			onInvited(l, User.fromEventUID(data.user));
 		});
 
 		return true;
@@ -4,6 +4,10 @@ typedef NetworkApi = {
 	function onConnectionRequest( u : User ) : Bool;
 	function onConnectionError( u : User, error : NetworkStatus ) : Void;
 	function onData( u : User, data : haxe.io.Bytes ) : Void;
+	/**
+		Allocation-free alternative to onData : `data` points into the receive buffer and is only valid during the call.
+	**/
+	@:optional function onRawData( u : User, data : hl.Bytes, len : Int ) : Void;
 }
 
 @:enum abstract NetworkStatus(Int) {
@@ -21,6 +25,66 @@ typedef NetworkApi = {
 	var ReliableWithBuffering = 3;
 }
 
+/**
+	SteamP2P uses the ISteamNetworking P2P sessions, SteamMessages uses ISteamNetworkingMessages when
+	the SDK provides it. Both ends must use the same backend.
+	Loopback does not need Steam : packets sent to any user are received locally, as if sent by that user.
+**/
+@:enum abstract P2PBackend(Int) {
+	var SteamP2P = 0;
+	var SteamMessages = 1;
+	var Loopback = 2;
+}
+
+typedef ChannelHandler = User -> hl.Bytes -> Int -> Void;
+
+private typedef P2PChannel = {
+	var channel : Int;
+	var priority : Int;
+	var budget : Int;
+	var onData : ChannelHandler;
+}
+
+/**
+	Statistics of one peer as written by `Networking.readStats`, read in place.
+	Channels 7 and above share the last channel slot. Histogram bucket 0 counts the intervals
+	under 1ms, and bucket i the ones between 2^(i-1) and 2^i ms (the last one has no upper bound).
+**/
+abstract PeerStats(hl.Bytes) {
+
+	public static inline var SIZE = 352;
+	public static inline var CHANNELS = 8;
+	public static inline var BUCKETS = 16;
+
+	public var user(get, never) : User;
+	/** round trip time in ms, -1 if unknown (only measured by the SteamMessages backend) **/
+	public var ping(get, never) : Int;
+	public var sendQueueBytes(get, never) : Int;
+	public var sendQueuePackets(get, never) : Int;
+	public var sendQueueBytesMax(get, never) : Int;
+	public var sendQueuePacketsMax(get, never) : Int;
+
+	public inline function new( buffer : hl.Bytes, index : Int ) {
+		this = buffer.offset(index * SIZE);
+	}
+
+	inline function get_user() return @:privateAccess Networking.getPeer(this, 0);
+	inline function get_ping() return this.getI32(8);
+	inline function get_sendQueueBytes() return this.getI32(16);
+	inline function get_sendQueuePackets() return this.getI32(20);
+	inline function get_sendQueueBytesMax() return this.getI32(24);
+	inline function get_sendQueuePacketsMax() return this.getI32(28);
+
+	public inline function getPacketsOut( channel : Int ) return this.getI32(32 + channel * 24);
+	public inline function getPacketsIn( channel : Int ) return this.getI32(36 + channel * 24);
+	public inline function getBytesOut( channel : Int ) return this.getF64(40 + channel * 24);
+	public inline function getBytesIn( channel : Int ) return this.getF64(48 + channel * 24);
+	/** number of packets received that long after the previous one from this peer **/
+	public inline function getArrivals( bucket : Int ) return this.getI32(224 + bucket * 4);
+	/** number of ping samples in this bucket, one per `readStats` **/
+	public inline function getPings( bucket : Int ) return this.getI32(288 + bucket * 4);
+}
+
 typedef NetworkSessionData = {
 	var connecting : Bool;
 	var alive : Bool;
@@ -37,9 +101,25 @@ class Networking {
 
 	static var initDone = false;
 	static var api : NetworkApi;
-	static var connections : Map<String,UID> = new Map();
+	static var connections : Map<Int,User> = new Map();
 	static var buffer : hl.Bytes = null;
 	static var bufferSize = 0;
+	static var peers = new Map<Int,User>();
+	static var channels : Array<P2PChannel> = [{ channel : 0, priority : 0, budget : -1, onData : null }];
+	static var channelHandlers = new Map<Int,ChannelHandler>();
+	static var channelTable : hl.Bytes = null;
+	static var coalescedChannels = 0;
+	static var threadSettings : { queueSize : Int, pollInterval : Int } = null;
+	static var backend = SteamP2P;
+	static var onMessage : hl.Bytes -> hl.Bytes -> Void;
+
+	/**
+		Arrival time of the packet being handled, comparable with `getTime()`.
+	**/
+	public static var packetTime(default, null) : Float = 0.;
+
+	static inline var HEADER_SIZE = 24;
+	static inline var DEFAULT_BUFFER_SIZE = 64 << 10;
 
 	public static function startP2P( napi : NetworkApi ) {
 		api = napi;
@@ -48,55 +128,303 @@ class Networking {
 
 		initDone = true;
 		// P2PSessionRequest_t
-		Api.registerGlobalEvent(1202, function(data:{uid:UID}) {
-			if( api == null ) return;
-			var user = User.fromUID(data.uid);
-			if( api.onConnectionRequest(user) ) {
-				if( !accept_p2p_session(data.uid) )
-					throw "fail to accept p2p session";
-				addConnection(user);
-			}
-		});
-
+		Api.registerTypedEvent(1202, new Event.SessionRequestEvent(), onSessionRequest);
 		// P2PSessionConnectFail_t
-		Api.registerGlobalEvent(1203, function(data:{uid:UID, error:NetworkStatus}) {
-			if( api != null )
-				api.onConnectionError(User.fromUID(data.uid), data.error);
-		});
+		Api.registerTypedEvent(1203, new Event.SessionFailedEvent(), onSessionFailed);
+		// SteamNetworkingMessagesSessionRequest_t
+		Api.registerTypedEvent(1251, new Event.SessionRequestEvent(), onSessionRequest);
+		// SteamNetworkingMessagesSessionFailed_t
+		Api.registerTypedEvent(1252, new Event.SessionFailedEvent(), onSessionFailed);
 
 		haxe.MainLoop.add(checkP2PMessage);
 	}
 
+	static function onSessionRequest( data : Event.SessionRequestEvent ) {
+		if( api == null ) return;
+		var user = User.fromEventUID(data.uid);
+		if( api.onConnectionRequest(user) ) {
+			if( !accept_p2p_session(data.uid) )
+				throw "fail to accept p2p session";
+			addConnection(user);
+		}
+	}
+
+	static function onSessionFailed( data : Event.SessionFailedEvent ) {
+		if( api != null )
+			api.onConnectionError(User.fromEventUID(data.uid), data.error);
+	}
+
 	static function checkP2PMessage() {
 		if( api == null ) return;
-		// decode message !
-		var len = 0;
+		if( buffer == null ) {
+			bufferSize = DEFAULT_BUFFER_SIZE;
+			buffer = new hl.Bytes(bufferSize);
+		}
+		if( coalescedChannels != 0 )
+			flush_p2p_packets();
+		if( channelTable == null )
+			buildChannelTable();
+		// reset per-frame budgets, the native side decrements them as it reads
+		for( i in 0...channels.length )
+			channelTable.setI32((i << 3) + 4, channels[i].budget);
+		// messages backend : handlers read the Steam messages in place (unless replaying a capture)
+		if( backend == SteamMessages && threadSettings == null ) {
+			if( onMessage == null )
+				onMessage = handleMessage;
+			try {
+				if( receive_p2p_messages(channelTable, channels.length, onMessage) >= 0 )
+					return;
+			} catch( e : Dynamic ) {
+				networkError(e);
+				return;
+			}
+		}
+		// decode messages : one native call empties the queues (or fills the buffer)
+		var pending = 0;
 		while( true ) {
-			var result;
+			var size;
 			try {
-				result = is_p2p_packet_available(len, 0);
+				size = read_p2p_channels(buffer, bufferSize, channelTable, channels.length, pending);
 			} catch( e : Dynamic ) {
-				var flags = new haxe.EnumFlags<hl.UI.DialogFlags>();
-				flags.set(IsError);
-				hl.UI.dialog("Error", "An error occured in network layer, Steam can no longer be reached.\n("+Std.string(e)+")", flags);
-				Sys.exit(1);
+				networkError(e);
 				return;
 			}
-			if( !result )
+			var pos = 0;
+			while( pos < size ) {
+				var len = buffer.getI32(pos + 12);
+				handlePacket(buffer, pos, buffer.offset(pos + HEADER_SIZE));
+				if( api == null ) return;
+				pos += HEADER_SIZE + len;
+			}
+			// the packets already read are all dispatched, but channels changed by a handler : resume next frame
+			if( pending == 0 || channelTable == null )
 				break;
-			if( len > bufferSize ) {
-				bufferSize = len;
+			if( size == 0 ) {
+				// next packet is bigger than the whole buffer
+				while( bufferSize < pending ) bufferSize <<= 1;
 				buffer = new hl.Bytes(bufferSize);
 			}
-			var uid = read_p2p_packet(buffer, bufferSize, len, 0);
-			if( uid == null ) continue;
-			api.onData(User.fromUID(uid), buffer.toBytes(len));
 		}
 	}
 
-	public static function sendP2P( user : User, data : haxe.io.Bytes, type : PacketType, pos = 0, len = -1 ) {
+	static function handlePacket( header : hl.Bytes, pos : Int, data : hl.Bytes ) {
+		var channel = header.getI32(pos + 8);
+		var len = header.getI32(pos + 12);
+		var user = getPeer(header, pos);
+		packetTime = header.getF64(pos + 16);
+		var callb = channelHandlers.get(channel);
+		if( callb != null )
+			callb(user, data, len);
+		else if( api.onRawData != null )
+			api.onRawData(user, data, len);
+		else
+			api.onData(user, data.toBytes(len));
+	}
+
+	static function handleMessage( header : hl.Bytes, data : hl.Bytes ) {
+		// the remaining messages of this frame are dropped once closed
+		if( api != null )
+			handlePacket(header, 0, data);
+	}
+
+	static function networkError( e : Dynamic ) {
+		var flags = new haxe.EnumFlags<hl.UI.DialogFlags>();
+		flags.set(IsError);
+		hl.UI.dialog("Error", "An error occured in network layer, Steam can no longer be reached.\n("+Std.string(e)+")", flags);
+		Sys.exit(1);
+	}
+
+	/**
+		Select the transport used by all sessions. Must be called while the receive thread is stopped,
+		returns false if the backend is not available with this Steam SDK.
+	**/
+	public static function setBackend( b : P2PBackend ) {
+		if( !set_p2p_backend(b) )
+			return false;
+		backend = b;
+		return true;
+	}
+
+	/**
+		Listen to `channel`. Channels with a higher `priority` are drained first, and `byteBudget` limits
+		how many bytes the channel can process each frame (-1 for no limit) : the remaining packets
+		stay queued until the next frame. Packets are sent to `onData` if set, or to the NetworkApi otherwise.
+	**/
+	public static function setChannel( channel : Int, priority : Int, byteBudget = -1, ?onData : ChannelHandler ) {
+		removeChannel(channel);
+		channels.push({ channel : channel, priority : priority, budget : byteBudget, onData : onData });
+		channels.sort(function(c1, c2) return c2.priority - c1.priority);
+		if( onData != null )
+			channelHandlers.set(channel, onData);
+		channelTable = null;
+		restartReceiveThread();
+	}
+
+	/**
+		Stop reading packets on `channel`, they will stay queued until the channel is set again.
+	**/
+	public static function removeChannel( channel : Int ) {
+		for( c in channels )
+			if( c.channel == channel ) {
+				channels.remove(c);
+				break;
+			}
+		channelHandlers.remove(channel);
+		channelTable = null;
+		restartReceiveThread();
+	}
+
+	/**
+		Read packets from a native thread that polls Steam continuously, so that slow frames no longer delay
+		reception and `packetTime` reports the actual arrival time. Packets are queued natively (up to `queueSize`
+		bytes per channel) until the next frame. Only channels 0 to 31 are polled by the thread.
+		@param pollInterval sleep time of the thread in microseconds when no packet is available
+	**/
+	public static function startReceiveThread( queueSize = 1 << 20, pollInterval = 500 ) {
+		threadSettings = { queueSize : queueSize, pollInterval : pollInterval };
+		return restartReceiveThread();
+	}
+
+	public static function stopReceiveThread() {
+		threadSettings = null;
+		stop_p2p_thread();
+	}
+
+	/**
+		The number of packets the receive thread discarded because they were larger than `queueSize`.
+	**/
+	public static function getReceiveThreadDropped() : Int {
+		return get_p2p_thread_dropped();
+	}
+
+	static function restartReceiveThread() {
+		if( threadSettings == null )
+			return false;
+		var mask = 0;
+		for( c in channels )
+			if( c.channel >= 0 && c.channel < 32 )
+				mask |= 1 << c.channel;
+		return start_p2p_thread(mask, threadSettings.queueSize, threadSettings.pollInterval);
+	}
+
+	/**
+		Append every packet sent and received to the memory-mapped file at `path`, with its time, peer and channel.
+		Packets are no longer recorded once the file reaches `maxSize` bytes.
+		Capture and replay can only be started or stopped while the receive thread is stopped.
+	**/
+	public static function startCapture( path : String, maxSize = 256. * 1024 * 1024 ) {
+		return start_p2p_capture(@:privateAccess path.toUtf8(), maxSize);
+	}
+
+	/**
+		Close the capture file, returns the number of packets that did not fit in it.
+	**/
+	public static function stopCapture() {
+		return stop_p2p_capture();
+	}
+
+	/**
+		Read the packets received in a capture instead of the network, at the recorded pace multiplied by `speed`,
+		or as fast as possible if `speed` is 0. Packets sent during the replay are discarded.
+	**/
+	public static function startReplay( path : String, speed = 1. ) {
+		return start_p2p_replay(@:privateAccess path.toUtf8(), speed);
+	}
+
+	public static function stopReplay() {
+		stop_p2p_replay();
+	}
+
+	/**
+		Number of packets of the replay that have not been read yet.
+	**/
+	public static function getReplayRemaining() {
+		return get_p2p_replay_remaining();
+	}
+
+	/**
+		Write the statistics of up to `maxPeers` peers to `buffer` (`PeerStats.SIZE` bytes each) without allocating,
+		returns the number of peers. Send queues and pings are sampled during the call.
+	**/
+	public static function readStats( buffer : hl.Bytes, maxPeers : Int ) : Int {
+		return read_p2p_stats(buffer, maxPeers);
+	}
+
+	public static function resetStats() {
+		reset_p2p_stats();
+	}
+
+	/**
+		Current time of the clock used for `packetTime`, in seconds.
+	**/
+	public static function getTime() : Float {
+		return get_p2p_time();
+	}
+
+	/**
+		Pack the messages sent on `channel` (0-31) into MTU-sized datagrams per peer instead of sending
+		them one by one. The datagrams are sent when the peer buffer is full and when `flush` is called,
+		which is done every frame before reading packets. Both ends must enable it on the channel.
+	**/
+	public static function setCoalesce( channel : Int, b : Bool ) {
+		if( !set_p2p_coalesce(channel, b) )
+			return false;
+		if( b )
+			coalescedChannels |= 1 << channel;
+		else
+			coalescedChannels &= ~(1 << channel);
+		return true;
+	}
+
+	/**
+		Split the messages sent on `channel` (0-31) that are larger than the MTU into fragments, so that
+		large payloads can be sent unreliably. A message is dropped if one of its fragments is lost.
+		Both ends must enable it on the channel. Returns false if the messages still coalesced on the channel could not be sent.
+	**/
+	public static function setFragment( channel : Int, b : Bool ) {
+		return set_p2p_fragment(channel, b);
+	}
+
+	/**
+		Size the preallocated reassembly arena : `slots` messages of up to `maxMessageSize` bytes can be
+		rebuilt at the same time, and the ones still incomplete after `timeout` seconds are dropped.
+		Defaults to 16 messages of 64KB and 1 second.
+	**/
+	public static function setReassembly( maxMessageSize : Int, slots : Int, timeout : Float ) {
+		return set_p2p_reassembly(maxMessageSize, slots, timeout);
+	}
+
+	/**
+		Send the messages packed since the last flush. Call it at the end of your frame for the lowest latency.
+	**/
+	public static function flush() {
+		return coalescedChannels == 0 || flush_p2p_packets();
+	}
+
+	static function buildChannelTable() {
+		channelTable = new hl.Bytes(channels.length << 3);
+		for( i in 0...channels.length )
+			channelTable.setI32(i << 3, channels[i].channel);
+	}
+
+	/**
+		Resolve the sender of the packet header at `pos` without allocating when the peer is already known.
+	**/
+	static function getPeer( buf : hl.Bytes, pos : Int ) {
+		var id = buf.getI32(pos);
+		var u = peers.get(id);
+		if( u == null || (cast u.uid : hl.Bytes).compare(0, buf, pos, 8) != 0 ) {
+			var uid = new hl.Bytes(8);
+			uid.blit(0, buf, pos, 8);
+			u = User.fromUID(cast uid);
+			peers.set(id, u);
+		}
+		return u;
+	}
+
+	public static function sendP2P( user : User, data : haxe.io.Bytes, type : PacketType, pos = 0, len = -1, channel = 0 ) {
 		if( len < 0 ) len = data.length;
-		if( !send_p2p_packet(user.uid, (data:hl.Bytes).offset(pos), len, type, 0) )
+		if( !send_p2p_packet(user.uid, (data:hl.Bytes).offset(pos), len, type, channel) )
 			return false;
 		addConnection(user);
 		return true;
@@ -108,22 +436,23 @@ class Networking {
 			user.p2pcnx = false;
 		}
 		close_p2p_session(user.uid);
-		connections.remove(user.uid.toString());
+		connections.remove(user.id);
 	}
 
 	static inline function addConnection( user : User ) {
 		@:privateAccess if( !user.p2pcnx ) {
 			user.p2pcnx = true;
-			connections.set(user.uid.toString(), user.uid);
+			connections.set(user.id, user);
 		}
 	}
 
 	public static function closeP2P() {
 		api = null;
+		stopReceiveThread();
 		var cnx = connections;
 		connections = new Map();
-		for( c in cnx )
-			closeSession(User.fromUID(c));
+		for( u in cnx )
+			closeSession(u);
 	}
 
 
@@ -137,10 +466,87 @@ class Networking {
 		return false;
 	}
 
+	static function flush_p2p_packets() : Bool {
+		return false;
+	}
+
+	static function set_p2p_coalesce( channel : Int, b : Bool ) : Bool {
+		return false;
+	}
+
+	static function set_p2p_fragment( channel : Int, b : Bool ) : Bool {
+		return false;
+	}
+
+	static function set_p2p_reassembly( maxMessageSize : Int, slots : Int, timeout : Float ) : Bool {
+		return false;
+	}
+
 	static function read_p2p_packet( out : hl.Bytes, maxLen : Int, len : hl.Ref<Int>, channel : Int ) : UID {
 		return null;
 	}
 
+	static function read_p2p_packet_id( out : hl.Bytes, maxLen : Int, len : hl.Ref<Int>, channel : Int ) : Int {
+		return 0;
+	}
+
+	static function read_p2p_packets( out : hl.Bytes, maxLen : Int, channel : Int, pending : hl.Ref<Int> ) : Int {
+		return 0;
+	}
+
+	static function read_p2p_channels( out : hl.Bytes, maxLen : Int, channels : hl.Bytes, count : Int, pending : hl.Ref<Int> ) : Int {
+		return 0;
+	}
+
+	static function receive_p2p_messages( channels : hl.Bytes, count : Int, onMessage : hl.Bytes -> hl.Bytes -> Void ) : Int {
+		return 0;
+	}
+
+	static function set_p2p_backend( backend : P2PBackend ) : Bool {
+		return false;
+	}
+
+	static function start_p2p_capture( path : hl.Bytes, maxSize : Float ) : Bool {
+		return false;
+	}
+
+	static function stop_p2p_capture() : Int {
+		return -1;
+	}
+
+	static function start_p2p_replay( path : hl.Bytes, speed : Float ) : Bool {
+		return false;
+	}
+
+	static function stop_p2p_replay() : Void {
+	}
+
+	static function get_p2p_replay_remaining() : Int {
+		return 0;
+	}
+
+	static function start_p2p_thread( channels : Int, queueSize : Int, sleepMicros : Int ) : Bool {
+		return false;
+	}
+
+	static function stop_p2p_thread() : Void {
+	}
+
+	static function get_p2p_thread_dropped() : Int {
+		return 0;
+	}
+
+	static function read_p2p_stats( out : hl.Bytes, maxPeers : Int ) : Int {
+		return 0;
+	}
+
+	static function reset_p2p_stats() : Void {
+	}
+
+	static function get_p2p_time() : Float {
+		return 0.;
+	}
+
 	static function is_p2p_packet_available( len : hl.Ref<Int>, channel : Int ) {
 		return false;
 	}
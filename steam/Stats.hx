@@ -0,0 +1,61 @@
+package steam;
+
+/**
+	Stats registered once by name, then read and written all together in a single native call.
+	`values` holds one Float per registered stat (exact for int stats), indexed by the id returned by `register`.
+**/
+@:hlNative("steam")
+class Stats {
+
+	public static var count(default,null) = 0;
+	public static var values(default,null) : hl.BytesAccess<Float> = new hl.Bytes(0);
+	static var capacity = 0;
+
+	/**
+		Register a stat and return its id, the same stat registered twice keeps its id.
+	**/
+	public static function register( name : String, isFloat = false ) : Int {
+		var id = register_stat(@:privateAccess name.toUtf8(), isFloat);
+		if( id >= capacity ) {
+			var ncapacity = capacity == 0 ? 32 : capacity;
+			while( ncapacity <= id ) ncapacity <<= 1;
+			var nvalues = new hl.Bytes(ncapacity << 3);
+			nvalues.fill(0, ncapacity << 3, 0);
+			nvalues.blit(0, values, 0, count << 3);
+			values = nvalues;
+			capacity = ncapacity;
+		}
+		if( id >= count ) count = id + 1;
+		return id;
+	}
+
+	public static inline function get( id : Int ) : Float {
+		return values[id];
+	}
+
+	public static inline function set( id : Int, v : Float ) {
+		values[id] = v;
+	}
+
+	/**
+		Read all the registered stats into `values`, returns the number of stats read.
+	**/
+	public static function read() : Int {
+		return get_stats(values, 0, count);
+	}
+
+	/**
+		Set the stats of `values` that changed since they were last read or written, returns their number or -1 on failure.
+		They are stored with the next `Api.storeStats`.
+	**/
+	public static function write() : Int {
+		return set_stats(values, 0, count);
+	}
+
+	// -- native
+
+	static function register_stat( name : hl.Bytes, isFloat : Bool ) : Int { return -1; }
+	static function get_stats( values : hl.Bytes, start : Int, count : Int ) : Int { return 0; }
+	static function set_stats( values : hl.Bytes, start : Int, count : Int ) : Int { return -1; }
+
+}
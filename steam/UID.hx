@@ -13,6 +13,16 @@ abstract UID(hl.Bytes) {
 	public function getInt64() : haxe.Int64 {
 		return haxe.Int64.make(this.getI32(4), this.getI32(0));
 	}
+	public function copy() : UID {
+		var b = new hl.Bytes(8);
+		b.blit(0, this, 0, 8);
+		return new UID(b);
+	}
+	@:allow(steam) static function alloc() : UID {
+		var b = new hl.Bytes(8);
+		b.fill(0, 8, 0);
+		return new UID(b);
+	}
 	@:op(a == b) static function __compare( a : UID, b : UID ) {
 		return (cast a : hl.Bytes).compare(0, (cast b : hl.Bytes), 0, 8) == 0;
 	}
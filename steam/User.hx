@@ -27,7 +27,12 @@ enum AvatarSize {
 class User {
 
 	public var uid(default, null) : UID;
+	/**
+		The interned id of the user, a small index stable for the session that can be used as a map key.
+	**/
+	public var id(get, never) : Int;
 	public var name(get, never) : String;
+	var internedId = 0;
 	var cachedName : String;
 	var waiting : Array<haxe.EnumFlags<Changed>->Void>;
 	var p2pcnx : Bool;
@@ -37,6 +42,14 @@ class User {
 		waiting = [];
 	}
 
+	function get_id() {
+		if( internedId == 0 ) {
+			internedId = intern_uid(uid);
+			byId.set(internedId, this);
+		}
+		return internedId;
+	}
+
 	public function getID32() {
 		// lower 32 bits seems to be unique, then padded with 0x01100001
 		return (cast uid : hl.Bytes).getI32(0);
@@ -88,6 +101,7 @@ class User {
 
 	// this will most likely leak but we don't care
 	static var users = new Map<String, User>();
+	static var byId = new Map<Int, User>();
 
 	public static function fromUID( uid : UID ) {
 		var u = users.get(uid.toString());
@@ -97,6 +111,53 @@ class User {
 		return u;
 	}
 
+	/**
+		Same as `fromUID` for a UID that gets overwritten, such as the ones of typed events.
+	**/
+	public static function fromEventUID( uid : UID ) {
+		var u = users.get(uid.toString());
+		if( u != null ) return u;
+		return fromUID(uid.copy());
+	}
+
+	/**
+		The user of an interned id, as returned by the `*_ids` primitives. Only allocates for a new user.
+	**/
+	public static function fromId( id : Int ) {
+		if( id == 0 ) return null;
+		var u = byId.get(id);
+		if( u != null ) return u;
+		u = fromUID(get_interned_uid(id));
+		u.internedId = id;
+		byId.set(id, u);
+		return u;
+	}
+
+	/**
+		Shared buffer for the primitives writing interned ids.
+	**/
+	static var idBuffer = new hl.Bytes(256 << 2);
+	static var idBufferSize = 256;
+
+	static function readIds( read : hl.Bytes -> Int -> Int ) : Array<User> {
+		var count = read(idBuffer, idBufferSize);
+		if( count > idBufferSize ) {
+			while( idBufferSize < count ) idBufferSize <<= 1;
+			idBuffer = new hl.Bytes(idBufferSize << 2);
+			count = read(idBuffer, idBufferSize);
+			if( count > idBufferSize ) count = idBufferSize;
+		}
+		return [for( i in 0...count ) fromId(idBuffer.getI32(i << 2))];
+	}
+
+	static function intern_uid( uid : UID ) : Int {
+		return 0;
+	}
+
+	static function get_interned_uid( id : Int ) : UID {
+		return null;
+	}
+
 	public static function fromUID32( uid : Int ) {
 		var bytes = new hl.Bytes(8);
 		bytes.setI32(0, uid);
@@ -1,5 +1,6 @@
 package steam.ugc;
 import steam.UID;
+import steam.User;
 
 enum ItemState {
 	Subscribed;
@@ -26,14 +27,14 @@ class Item {
 	public static function init( onDownloaded : Item -> Void, onInstalled : Item -> Void ){
 		downloadedCallbacks.push(onDownloaded);
 		installedCallbacks.push(onInstalled);
-		Api.registerGlobalEvent(3400 + 6, function(data:{file:UID}){
-			var item = new Item(data.file);
+		Api.registerTypedEvent(3400 + 6, new steam.Event.ItemEvent(), function(data){
+			var item = new Item(data.file.copy());
 			for( callback in downloadedCallbacks ){
 				callback(item);
 			}
 		});
-		Api.registerGlobalEvent(3400 + 5, function(data:{file:UID}){
-			var item = new Item(data.file);
+		Api.registerTypedEvent(3400 + 5, new steam.Event.ItemEvent(), function(data){
+			var item = new Item(data.file.copy());
 			for( callback in installedCallbacks ){
 				callback(item);
 			}
@@ -50,9 +51,32 @@ class Item {
 		});
 	}
 
+	static var subscribed = new Map<Int,Item>();
+	static var idBuffer = new hl.Bytes(0);
+	static var idBufferSize = 0;
+
+	/**
+		The subscribed items, by interned id : an item listed before is not allocated again.
+	**/
 	public static function listSubscribed() : Array<Item> {
-		var a = get_subscribed_items();
-		return a == null ? null : [for( it in a ) new Item(it)];
+		var count = get_subscribed_item_ids(idBuffer, idBufferSize);
+		if( count > idBufferSize ) {
+			idBufferSize = count;
+			idBuffer = new hl.Bytes(count << 2);
+			count = get_subscribed_item_ids(idBuffer, idBufferSize);
+			if( count > idBufferSize ) count = idBufferSize;
+		}
+		var items = [];
+		for( i in 0...count ) {
+			var id = idBuffer.getI32(i << 2);
+			var item = subscribed.get(id);
+			if( item == null ) {
+				item = new Item(@:privateAccess User.get_interned_uid(id));
+				subscribed.set(id, item);
+			}
+			items.push(item);
+		}
+		return items;
 	}
 
 	inline function new( b : UID ){
@@ -128,6 +152,10 @@ class Item {
 		return null;
 	}
 
+	static function get_subscribed_item_ids( out : hl.Bytes, max : Int ) : Int {
+		return 0;
+	}
+
 	static function get_item_state( item : UID ) : Int {
 		return 0;
 	}